@@ -0,0 +1,120 @@
+/*************************************************************************
+ * Luis Maya Aranda
+ *
+ * List Benchmark
+ * Runs a mixed workload of contains(), add() and remove() against
+ * OptimisticList, LazyList and LockFreeList for a growing number of
+ * threads, and writes one CSV row per run with throughput, latency
+ * percentiles and hardware counters per operation.
+ *
+ * Usage: ListBenchmark [seconds per run] [key range] [update percent]
+ *
+ * **********************************************************************/
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+#include "BenchmarkStats.hpp"
+#include "LazyList.hpp"
+#include "LockFreeList.hpp"
+#include "OptimisticList.hpp"
+
+struct Workload {
+    double seconds;
+    int keys;
+    int updatePercent;
+};
+
+/*************************************************************************
+ * Prefill half of the key range, then let every thread pick random keys
+ * until the run is over. Each thread records into its own histogram, the
+ * histograms are merged once all threads have joined.
+ * **********************************************************************/
+template <class List>
+BenchmarkRecord run(const string &name, int threads, const Workload &workload) {
+    List list;
+    for (int key = 0; key < workload.keys; key += 2)
+        list.add(key);
+
+    BenchmarkRecord record(name, threads);
+    vector<LatencyHistogram> latencies(threads);
+    vector<uint64_t> operations(threads, 0);
+    atomic<bool> stop(false);
+
+    PerfCounters counters;
+    counters.start();
+    auto start = chrono::steady_clock::now();
+
+    vector<thread> workers;
+    for (int t = 0; t < threads; t++) {
+        workers.emplace_back([&, t] {
+            mt19937 random(t + 1);
+            uniform_int_distribution<int> keys(0, workload.keys - 1);
+            uniform_int_distribution<int> percent(0, 99);
+
+            while (!stop.load(memory_order_relaxed)) {
+                int key = keys(random);
+                int op = percent(random);
+                {
+                    LatencyTimer timer(latencies[t]);
+                    if (op < workload.updatePercent / 2)
+                        list.add(key);
+                    else if (op < workload.updatePercent)
+                        list.remove(key);
+                    else
+                        list.contains(key);
+                }
+                operations[t]++;
+            }
+        });
+    }
+
+    this_thread::sleep_for(chrono::duration<double>(workload.seconds));
+    stop = true;
+    for (auto &worker : workers)
+        worker.join();
+
+    auto elapsed = chrono::steady_clock::now() - start;
+    counters.stop();
+
+    for (int t = 0; t < threads; t++) {
+        record.latency.merge(latencies[t]);
+        record.operations += operations[t];
+    }
+    record.seconds = chrono::duration<double>(elapsed).count();
+    record.setCounters(counters);
+    return record;
+}
+
+int main(int argc, char *argv[]) {
+    Workload workload;
+    workload.seconds = argc > 1 ? atof(argv[1]) : 1.0;
+    workload.keys = argc > 2 ? atoi(argv[2]) : 1024;
+    workload.updatePercent = argc > 3 ? atoi(argv[3]) : 20;
+
+    if (workload.seconds <= 0 || workload.keys <= 0 || workload.updatePercent < 0 || workload.updatePercent > 100) {
+        cerr << "usage: " << argv[0] << " [seconds per run] [key range] [update percent]" << endl;
+        return 1;
+    }
+
+    int maxThreads = max(1u, thread::hardware_concurrency());
+    vector<int> threadCounts;
+    for (int threads = 1; threads < maxThreads; threads *= 2)
+        threadCounts.push_back(threads);
+    threadCounts.push_back(maxThreads);
+
+    BenchmarkRecord::writeCsvHeader(cout);
+    for (int threads : threadCounts) {
+        run<OptimisticList<int>>("OptimisticList", threads, workload).writeCsv(cout);
+        run<LazyList<int>>("LazyList", threads, workload).writeCsv(cout);
+        run<LockFreeList<int>>("LockFreeList", threads, workload).writeCsv(cout);
+    }
+    return 0;
+}
@@ -0,0 +1,494 @@
+/*************************************************************************
+ * Adaptive Set
+ *
+ * A lock-free set that behaves as a single sorted list while it is small
+ * and as a hash table once it grows, without ever copying its nodes. All
+ * nodes live in one lock-free list ordered by the bit-reversed hash of
+ * their key (a split-ordered list, after Shalev and Shavit). A table of
+ * bucket sentinels gives shortcuts into that list: with one bucket every
+ * operation walks the whole list from its head, as in the lock-free list.
+ * When the average bucket grows past the load factor the number of
+ * buckets doubles, and each new bucket's sentinel is spliced into the list
+ * the first time an operation needs it, so growth happens online with no
+ * pause. When the set shrinks the number of buckets halves again, and the
+ * sentinels of the dropped buckets are unlinked and retired, so a set that
+ * grew large and shrank again walks only as many sentinels as it uses.
+ * Sentinels are created and pruned under a lock that is only ever tried:
+ * an operation that finds it busy starts from an ancestor bucket instead
+ * of waiting, so the set stays lock-free.
+ *
+ * Removed nodes are freed by reclaim(), as in the lock-free list.
+ *
+ * **********************************************************************/
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <iostream>
+#include <mutex>
+
+#include "StripedCounter.hpp"
+
+template <class T, class Hash = std::hash<T>>
+class AdaptiveSet {
+   public:
+    AdaptiveSet(std::size_t = DEFAULT_LOAD);
+    ~AdaptiveSet();
+    bool contains(T);
+    bool add(T);
+    bool remove(T);
+    std::size_t size() const;
+    std::size_t buckets() const;
+    void reclaim();
+    void printList();
+
+    // Average number of keys per bucket before the bucket count doubles
+    static const std::size_t DEFAULT_LOAD = 4;
+
+   private:
+    struct Node {
+        // Bit-reversed hash: odd for keys, even for bucket sentinels
+        std::uint64_t order;
+        T key;
+        // Successor with the mark in the low bit
+        std::atomic<std::uintptr_t> next;
+        Node *retiredNext;
+
+        Node(std::uint64_t myOrder, const T &myKey) : order(myOrder), key(myKey), next(0), retiredNext(NULL) {}
+    };
+
+    // Segment 0 holds bucket 0, segment s > 0 holds buckets 2^(s-1) up to
+    // 2^s - 1
+    static const int SEGMENTS = 48;
+    static const std::size_t MAX_BUCKETS = std::size_t(1) << (SEGMENTS - 1);
+
+    std::atomic<std::atomic<Node *> *> segments[SEGMENTS];
+    std::atomic<std::size_t> used;
+    // Buckets below this may have a sentinel, see prune()
+    std::atomic<std::size_t> initialized;
+    std::mutex tableLock;
+    std::size_t load;
+    StripedCounter count;
+    std::atomic<Node *> retired;
+
+    static std::uint64_t reverse(std::uint64_t);
+    static std::uint64_t hashOf(const T &);
+    static Node *pointer(std::uintptr_t link) {
+        return reinterpret_cast<Node *>(link & ~std::uintptr_t(1));
+    }
+    static bool marked(std::uintptr_t link) {
+        return link & 1;
+    }
+    static std::uintptr_t pack(Node *node) {
+        return reinterpret_cast<std::uintptr_t>(node);
+    }
+    static std::size_t parentOf(std::size_t index) {
+        return index & ~(std::size_t(1) << (63 - __builtin_clzll(index)));
+    }
+    static bool before(Node *, std::uint64_t, const T &, bool);
+    std::atomic<Node *> &slot(std::size_t);
+    Node *peek(std::size_t);
+    Node *bucket(std::size_t);
+    Node *origin(std::size_t);
+    Node *nearest(std::size_t);
+    bool find(Node *, std::uint64_t, const T &, bool, Node *&, Node *&);
+    void retire(Node *);
+    void resize();
+    void prune();
+};
+
+/*
+ * Start with a single bucket, so the set is one list. load is the
+ * average number of keys per bucket at which the bucket count doubles.
+ */
+template <class T, class Hash>
+AdaptiveSet<T, Hash>::AdaptiveSet(std::size_t myLoad)
+    : used(1), initialized(1), load(myLoad ? myLoad : 1), retired(NULL) {
+    for (int i = 0; i < SEGMENTS; i++)
+        segments[i].store(NULL, std::memory_order_relaxed);
+    slot(0).store(new Node(0, T()));
+}
+
+template <class T, class Hash>
+AdaptiveSet<T, Hash>::~AdaptiveSet() {
+    reclaim();
+
+    Node *curr = slot(0).load();
+    while (curr != NULL) {
+        Node *next = pointer(curr->next.load());
+        delete curr;
+        curr = next;
+    }
+
+    for (int i = 0; i < SEGMENTS; i++)
+        delete[] segments[i].load();
+}
+
+/*
+ * Wait-free lookup walking from the sentinel of the key's bucket
+ */
+template <class T, class Hash>
+bool AdaptiveSet<T, Hash>::contains(T key) {
+    std::uint64_t hash = hashOf(key);
+    std::uint64_t order = reverse(hash) | 1;
+
+    Node *curr = pointer(origin(hash & (used.load() - 1))->next.load());
+    while (curr != NULL && before(curr, order, key, false))
+        curr = pointer(curr->next.load());
+
+    return curr != NULL && curr->order == order && curr->key == key && !marked(curr->next.load());
+}
+
+/*
+ * Add the given parameter to the set. Returns false if it was already
+ * present.
+ */
+template <class T, class Hash>
+bool AdaptiveSet<T, Hash>::add(T key) {
+    std::uint64_t hash = hashOf(key);
+    std::uint64_t order = reverse(hash) | 1;
+    std::size_t index = hash & (used.load() - 1);
+    Node *node = NULL;
+
+    while (true) {
+        Node *pred, *curr;
+        if (!find(origin(index), order, key, false, pred, curr))
+            continue;
+
+        if (curr != NULL && curr->order == order && curr->key == key) {
+            delete node;
+            return false;
+        }
+
+        if (node == NULL)
+            node = new Node(order, key);
+        node->next.store(pack(curr), std::memory_order_relaxed);
+
+        std::uintptr_t expected = pack(curr);
+        if (pred->next.compare_exchange_strong(expected, pack(node)))
+            break;
+    }
+
+    count.add(1);
+    resize();
+    return true;
+}
+
+/*
+ * Remove the given parameter from the set. Returns false if it was not
+ * present.
+ */
+template <class T, class Hash>
+bool AdaptiveSet<T, Hash>::remove(T key) {
+    std::uint64_t hash = hashOf(key);
+    std::uint64_t order = reverse(hash) | 1;
+    std::size_t index = hash & (used.load() - 1);
+
+    while (true) {
+        Node *pred, *curr;
+        if (!find(origin(index), order, key, false, pred, curr))
+            continue;
+
+        if (curr == NULL || curr->order != order || !(curr->key == key))
+            return false;
+
+        // Logical removal
+        std::uintptr_t succ = curr->next.load();
+        if (marked(succ) || !curr->next.compare_exchange_strong(succ, succ | 1))
+            continue;
+        count.add(-1);
+
+        // Physical removal, left to later traversals if pred has changed
+        std::uintptr_t expected = pack(curr);
+        if (pred->next.compare_exchange_strong(expected, succ))
+            retire(curr);
+
+        resize();
+        return true;
+    }
+}
+
+template <class T, class Hash>
+std::size_t AdaptiveSet<T, Hash>::size() const {
+    return count.approximate();
+}
+
+template <class T, class Hash>
+std::size_t AdaptiveSet<T, Hash>::buckets() const {
+    return used.load();
+}
+
+/*
+ * Free removed nodes. The caller must ensure no other thread is still
+ * operating on the set.
+ */
+template <class T, class Hash>
+void AdaptiveSet<T, Hash>::reclaim() {
+    Node *curr = retired.exchange(NULL);
+    while (curr != NULL) {
+        Node *next = curr->retiredNext;
+        delete curr;
+        curr = next;
+    }
+}
+
+/*
+ * Print the keys in hash order
+ */
+template <class T, class Hash>
+void AdaptiveSet<T, Hash>::printList() {
+    Node *curr = pointer(slot(0).load()->next.load());
+    while (curr != NULL) {
+        std::uintptr_t next = curr->next.load();
+        if ((curr->order & 1) && !marked(next))
+            std::cout << curr->key << " ";
+        curr = pointer(next);
+    }
+    std::cout << std::endl;
+}
+
+template <class T, class Hash>
+std::uint64_t AdaptiveSet<T, Hash>::reverse(std::uint64_t x) {
+    x = ((x >> 1) & 0x5555555555555555ULL) | ((x & 0x5555555555555555ULL) << 1);
+    x = ((x >> 2) & 0x3333333333333333ULL) | ((x & 0x3333333333333333ULL) << 2);
+    x = ((x >> 4) & 0x0f0f0f0f0f0f0f0fULL) | ((x & 0x0f0f0f0f0f0f0f0fULL) << 4);
+    x = ((x >> 8) & 0x00ff00ff00ff00ffULL) | ((x & 0x00ff00ff00ff00ffULL) << 8);
+    x = ((x >> 16) & 0x0000ffff0000ffffULL) | ((x & 0x0000ffff0000ffffULL) << 16);
+    return (x >> 32) | (x << 32);
+}
+
+/*
+ * Hash the key and spread the bits, since std::hash is the identity for
+ * integers and the buckets are picked by the low bits
+ */
+template <class T, class Hash>
+std::uint64_t AdaptiveSet<T, Hash>::hashOf(const T &key) {
+    std::uint64_t h = Hash()(key);
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+    return h;
+}
+
+/*
+ * Whether node sorts before the given order and key. Sentinels are looked
+ * up by order alone.
+ */
+template <class T, class Hash>
+bool AdaptiveSet<T, Hash>::before(Node *node, std::uint64_t order, const T &key, bool sentinel) {
+    if (node->order != order)
+        return node->order < order;
+    return !sentinel && node->key < key;
+}
+
+/*
+ * The table entry of a bucket, allocating its segment on first use
+ */
+template <class T, class Hash>
+std::atomic<typename AdaptiveSet<T, Hash>::Node *> &AdaptiveSet<T, Hash>::slot(std::size_t index) {
+    int segment = index == 0 ? 0 : 64 - __builtin_clzll(index);
+    std::size_t first = segment == 0 ? 0 : std::size_t(1) << (segment - 1);
+
+    std::atomic<Node *> *entries = segments[segment].load(std::memory_order_acquire);
+    if (entries == NULL) {
+        std::size_t length = segment == 0 ? 1 : first;
+        std::atomic<Node *> *fresh = new std::atomic<Node *>[length]();
+        if (segments[segment].compare_exchange_strong(entries, fresh))
+            entries = fresh;
+        else
+            delete[] fresh;
+    }
+    return entries[index - first];
+}
+
+/*
+ * The sentinel of a bucket, or NULL if it has none, without allocating
+ * its segment
+ */
+template <class T, class Hash>
+typename AdaptiveSet<T, Hash>::Node *AdaptiveSet<T, Hash>::peek(std::size_t index) {
+    int segment = index == 0 ? 0 : 64 - __builtin_clzll(index);
+    if (segments[segment].load(std::memory_order_acquire) == NULL)
+        return NULL;
+    return slot(index).load(std::memory_order_acquire);
+}
+
+/*
+ * The sentinel of a bucket. A bucket in use for the first time is split
+ * from its nearest ancestor with a sentinel: its own sentinel is inserted
+ * into the list starting from the ancestor's. Returns NULL if the bucket
+ * has no sentinel and either is not in use or another thread holds the
+ * table lock.
+ */
+template <class T, class Hash>
+typename AdaptiveSet<T, Hash>::Node *AdaptiveSet<T, Hash>::bucket(std::size_t index) {
+    Node *sentinel = peek(index);
+    if (sentinel != NULL || index >= used.load())
+        return sentinel;
+
+    std::unique_lock<std::mutex> guard(tableLock, std::try_to_lock);
+    if (!guard.owns_lock())
+        return NULL;
+
+    std::atomic<Node *> &entry = slot(index);
+    sentinel = entry.load(std::memory_order_acquire);
+    if (sentinel != NULL || index >= used.load())
+        return sentinel;
+
+    std::uint64_t order = reverse(index);
+    Node *node = new Node(order, T());
+
+    while (true) {
+        Node *pred, *curr;
+        if (!find(nearest(parentOf(index)), order, node->key, true, pred, curr))
+            continue;
+
+        node->next.store(pack(curr), std::memory_order_relaxed);
+        std::uintptr_t expected = pack(curr);
+        if (pred->next.compare_exchange_strong(expected, pack(node)))
+            break;
+    }
+
+    entry.store(node, std::memory_order_release);
+    if (initialized.load() <= index)
+        initialized.store(index + 1);
+    return node;
+}
+
+/*
+ * The sentinel to start from for a bucket: its own, or that of its
+ * nearest ancestor if it has none yet or it is being pruned. Bucket 0 is
+ * never pruned.
+ */
+template <class T, class Hash>
+typename AdaptiveSet<T, Hash>::Node *AdaptiveSet<T, Hash>::origin(std::size_t index) {
+    while (true) {
+        Node *sentinel = bucket(index);
+        if (index == 0 || (sentinel != NULL && !marked(sentinel->next.load())))
+            return sentinel;
+        index = parentOf(index);
+    }
+}
+
+/*
+ * The sentinel of the bucket or of its nearest ancestor that has one,
+ * without creating any. Called with the table lock held, when no
+ * sentinel is being marked.
+ */
+template <class T, class Hash>
+typename AdaptiveSet<T, Hash>::Node *AdaptiveSet<T, Hash>::nearest(std::size_t index) {
+    while (true) {
+        Node *sentinel = peek(index);
+        if (sentinel != NULL)
+            return sentinel;
+        index = parentOf(index);
+    }
+}
+
+/*
+ * Set pred and curr to the nodes on either side of the order and key,
+ * starting from a sentinel and snipping marked nodes on the way, like the
+ * lock-free list's Window. curr is NULL at the end of the list. Returns
+ * false if the start sentinel itself has been marked by prune(), so the
+ * caller can start from another one.
+ */
+template <class T, class Hash>
+bool AdaptiveSet<T, Hash>::find(Node *start, std::uint64_t order, const T &key, bool sentinel, Node *&pred,
+                                Node *&curr) {
+RETRY:
+    while (true) {
+        pred = start;
+        std::uintptr_t first = pred->next.load();
+        if (marked(first))
+            return false;
+        curr = pointer(first);
+        while (curr != NULL) {
+            std::uintptr_t succ = curr->next.load();
+            if (marked(succ)) {
+                std::uintptr_t expected = pack(curr);
+                if (!pred->next.compare_exchange_strong(expected, pack(pointer(succ))))
+                    goto RETRY;
+                retire(curr);
+                curr = pointer(succ);
+                continue;
+            }
+
+            if (!before(curr, order, key, sentinel))
+                return true;
+            pred = curr;
+            curr = pointer(succ);
+        }
+        return true;
+    }
+}
+
+/*
+ * Push a removed node onto the retired stack. Only the thread whose CAS
+ * unlinked the node retires it.
+ */
+template <class T, class Hash>
+void AdaptiveSet<T, Hash>::retire(Node *node) {
+    node->retiredNext = retired.load();
+    while (!retired.compare_exchange_weak(node->retiredNext, node))
+        ;
+}
+
+/*
+ * Called after successful updates. Every 64 updates on a thread, doubles
+ * the bucket count when buckets average more than load keys, or halves
+ * it when they average less than a quarter of that, and prunes the
+ * sentinels of buckets no longer in use.
+ */
+template <class T, class Hash>
+void AdaptiveSet<T, Hash>::resize() {
+    thread_local std::size_t updates = 0;
+
+    if (++updates % 64 != 0)
+        return;
+
+    std::size_t curr = used.load();
+    std::size_t keys = count.approximate();
+    if (keys > curr * load && curr < MAX_BUCKETS)
+        used.compare_exchange_strong(curr, curr * 2);
+    else if (curr > 1 && keys * 4 < curr * load)
+        used.compare_exchange_strong(curr, curr / 2);
+
+    if (used.load() < initialized.load())
+        prune();
+}
+
+/*
+ * Unlink and retire the sentinels of buckets at or above the bucket
+ * count, unless another thread holds the table lock. Each sentinel is
+ * taken out of the table before it is marked, so operations that read it
+ * earlier see the mark and start from an ancestor instead. Buckets are
+ * pruned from the highest down, so the nearest ancestor a sentinel is
+ * snipped from has no other pruned sentinel left before it.
+ */
+template <class T, class Hash>
+void AdaptiveSet<T, Hash>::prune() {
+    std::unique_lock<std::mutex> guard(tableLock, std::try_to_lock);
+    if (!guard.owns_lock())
+        return;
+
+    std::size_t keep = used.load();
+    for (std::size_t index = initialized.load(); index-- > keep;) {
+        if (peek(index) == NULL)
+            continue;
+        Node *sentinel = slot(index).exchange(NULL);
+
+        std::uintptr_t succ = sentinel->next.load();
+        while (!sentinel->next.compare_exchange_weak(succ, succ | 1))
+            ;
+
+        // Snipped and retired by the traversal
+        Node *pred, *curr;
+        while (!find(nearest(parentOf(index)), sentinel->order, sentinel->key, true, pred, curr))
+            ;
+    }
+    initialized.store(keep);
+}
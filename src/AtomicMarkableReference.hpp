@@ -6,13 +6,18 @@ template <class T>
 struct MarkableReference {
     T* next;
     bool marked;
+    // Descriptor of a multi-key operation that has reserved the node owning
+    // this reference, or nullptr. Carried over unchanged by CAS().
+    void* owner;
 
-    MarkableReference() : next(nullptr), marked(false) {}
+    MarkableReference() : next(nullptr), marked(false), owner(nullptr) {}
 
-    MarkableReference(T* node, bool mark) : next(node), marked(mark) {}
+    MarkableReference(T* node, bool mark) : next(node), marked(mark), owner(nullptr) {}
+
+    MarkableReference(T* node, bool mark, void* own) : next(node), marked(mark), owner(own) {}
 
     bool operator==(const MarkableReference<T>& other) {
-        return (next == other.next && marked == other.marked);
+        return (next == other.next && marked == other.marked && owner == other.owner);
     }
 };
 
@@ -33,6 +38,10 @@ class AtomicMarkableReference {
         markedNext.store(new MarkableReference<T>(nextNode, mark));
     }
 
+    ~AtomicMarkableReference() {
+        delete markedNext.load();
+    }
+
     // Returns the reference. load() is atomic and hence that will be the linearization point
     T* getReference() {
         return markedNext.load()->next;
@@ -46,11 +55,19 @@ class AtomicMarkableReference {
         return temp->next;
     }
 
+    // Same as above, additionally returning the owner of the reference
+    T* get(bool* mark, void** owner) {
+        MarkableReference<T>* temp = markedNext.load();
+        *mark = temp->marked;
+        *owner = temp->owner;
+        return temp->next;
+    }
+
     // Set the variables unconditionally. load() is atomic and hence that will be the linearization point
     void set(T* newRef, bool newMark) {
         MarkableReference<T>* curr = markedNext.load();
 
-        if (newRef != curr->next || newMark != curr->marked) {
+        if (newRef != curr->next || newMark != curr->marked || curr->owner != nullptr) {
             markedNext.store(new MarkableReference<T>(newRef, newMark));
         }
     }
@@ -60,9 +77,10 @@ class AtomicMarkableReference {
     bool attemptMark(T* expected, bool newMark) {
         MarkableReference<T>* curr = markedNext.load();
 
-        if (expected == curr->next) {
-            markedNext.store(new MarkableReference<T>(expected, newMark));
-            return true;
+        while (expected == curr->next) {
+            if (newMark == curr->marked ||
+                markedNext.compare_exchange_strong(curr, new MarkableReference<T>(expected, newMark, curr->owner)))
+                return true;
         }
         return false;
     }
@@ -74,6 +92,26 @@ class AtomicMarkableReference {
         MarkableReference<T>* curr = markedNext.load();
         return (expected == curr->next && expectedBool == curr->marked &&
                 ((newValue == curr->next && newBool == curr->marked) ||
-                 markedNext.compare_exchange_strong(curr, new MarkableReference<T>(newValue, newBool))));
+                 markedNext.compare_exchange_strong(curr, new MarkableReference<T>(newValue, newBool, curr->owner))));
+    }
+
+    // Marks an unmarked reference only if it still points to expected and is
+    // owned by expectedOwner
+    bool mark(T* expected, void* expectedOwner) {
+        MarkableReference<T>* curr = markedNext.load();
+        return (expected == curr->next && !curr->marked && expectedOwner == curr->owner &&
+                markedNext.compare_exchange_strong(curr, new MarkableReference<T>(expected, true, expectedOwner)));
+    }
+
+    // Replaces the owner of an unmarked reference if it is expectedOwner,
+    // retrying while only the next pointer changes underneath
+    bool CASOwner(void* expectedOwner, void* newOwner) {
+        MarkableReference<T>* curr = markedNext.load();
+
+        while (!curr->marked && expectedOwner == curr->owner) {
+            if (markedNext.compare_exchange_strong(curr, new MarkableReference<T>(curr->next, false, newOwner)))
+                return true;
+        }
+        return false;
     }
 };
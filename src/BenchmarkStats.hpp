@@ -0,0 +1,260 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+/*
+ * Latency histogram with HDR-style log-linear buckets. Values below 128
+ * get a bucket each; above that every power of two is split into 64
+ * buckets, so any recorded value is reported within 1/64 of its true value
+ * while the whole 64-bit range fits in a few thousand counters.
+ *
+ * Recording is not thread-safe: give each thread its own histogram and
+ * merge() them once the run is over.
+ */
+class LatencyHistogram {
+   private:
+    static const int SUB_BITS = 7;
+    static const std::uint64_t SUB_COUNT = 1 << SUB_BITS;
+    static const std::uint64_t HALF_COUNT = SUB_COUNT / 2;
+    static const std::size_t BUCKETS = (64 - SUB_BITS + 1) * HALF_COUNT + HALF_COUNT;
+
+    std::vector<std::uint64_t> counts;
+    std::uint64_t total;
+    std::uint64_t maximum;
+
+    static std::size_t index(std::uint64_t value) {
+        if (value < SUB_COUNT)
+            return value;
+        int shift = 63 - __builtin_clzll(value) - (SUB_BITS - 1);
+        return shift * HALF_COUNT + (value >> shift);
+    }
+
+    // Highest value that falls in the bucket
+    static std::uint64_t upper(std::size_t bucket) {
+        if (bucket < SUB_COUNT)
+            return bucket;
+        int shift = bucket / HALF_COUNT - 1;
+        std::uint64_t mantissa = bucket - shift * HALF_COUNT;
+        return ((mantissa + 1) << shift) - 1;
+    }
+
+   public:
+    LatencyHistogram() : counts(BUCKETS, 0), total(0), maximum(0) {}
+
+    void record(std::uint64_t nanos) {
+        counts[index(nanos)]++;
+        total++;
+        if (nanos > maximum)
+            maximum = nanos;
+    }
+
+    void merge(const LatencyHistogram &other) {
+        for (std::size_t i = 0; i < BUCKETS; i++)
+            counts[i] += other.counts[i];
+        total += other.total;
+        if (other.maximum > maximum)
+            maximum = other.maximum;
+    }
+
+    void reset() {
+        std::fill(counts.begin(), counts.end(), 0);
+        total = 0;
+        maximum = 0;
+    }
+
+    std::uint64_t count() const {
+        return total;
+    }
+
+    std::uint64_t max() const {
+        return maximum;
+    }
+
+    // Smallest bucket bound that at least the given percent of the recorded
+    // values do not exceed
+    std::uint64_t percentile(double percent) const {
+        if (total == 0)
+            return 0;
+
+        std::uint64_t target = static_cast<std::uint64_t>(percent / 100.0 * total + 0.5);
+        if (target == 0)
+            target = 1;
+
+        std::uint64_t seen = 0;
+        for (std::size_t i = 0; i < BUCKETS; i++) {
+            seen += counts[i];
+            if (seen >= target)
+                return upper(i) < maximum ? upper(i) : maximum;
+        }
+        return maximum;
+    }
+};
+
+/*
+ * Times a single operation into a histogram, e.g.
+ *
+ *     { LatencyTimer timer(histogram); list.add(key); }
+ */
+class LatencyTimer {
+   private:
+    LatencyHistogram &histogram;
+    std::chrono::steady_clock::time_point start;
+
+   public:
+    LatencyTimer(LatencyHistogram &hist) : histogram(hist), start(std::chrono::steady_clock::now()) {}
+
+    ~LatencyTimer() {
+        auto elapsed = std::chrono::steady_clock::now() - start;
+        histogram.record(std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count());
+    }
+};
+
+/*
+ * Hardware performance counters for the calling process, read through
+ * perf_event_open. Counters follow threads created after construction, so
+ * a run that spawns its workers afterwards is counted as a whole. Each counter is
+ * opened on its own: counters the kernel or the virtual machine does not
+ * provide are reported unavailable rather than failing the run.
+ */
+class PerfCounters {
+   public:
+    enum Counter { CACHE_MISSES, LLC_MISSES, BRANCH_MISSES, INSTRUCTIONS, COUNTERS };
+
+   private:
+    int fds[COUNTERS];
+    std::uint64_t values[COUNTERS];
+
+#ifdef __linux__
+    static int open(std::uint32_t type, std::uint64_t config) {
+        perf_event_attr attr;
+        std::memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = type;
+        attr.config = config;
+        attr.disabled = 1;
+        attr.inherit = 1;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        return syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+    }
+#endif
+
+   public:
+    PerfCounters() {
+        for (int i = 0; i < COUNTERS; i++) {
+            fds[i] = -1;
+            values[i] = 0;
+        }
+#ifdef __linux__
+        fds[CACHE_MISSES] = open(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES);
+        fds[LLC_MISSES] = open(PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_LL | (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                                                       (PERF_COUNT_HW_CACHE_RESULT_MISS << 16));
+        fds[BRANCH_MISSES] = open(PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES);
+        fds[INSTRUCTIONS] = open(PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS);
+#endif
+    }
+
+    ~PerfCounters() {
+#ifdef __linux__
+        for (int i = 0; i < COUNTERS; i++)
+            if (fds[i] != -1)
+                close(fds[i]);
+#endif
+    }
+
+    PerfCounters(const PerfCounters &) = delete;
+    PerfCounters &operator=(const PerfCounters &) = delete;
+
+    void start() {
+#ifdef __linux__
+        for (int i = 0; i < COUNTERS; i++) {
+            if (fds[i] != -1) {
+                ioctl(fds[i], PERF_EVENT_IOC_RESET, 0);
+                ioctl(fds[i], PERF_EVENT_IOC_ENABLE, 0);
+            }
+        }
+#endif
+    }
+
+    void stop() {
+#ifdef __linux__
+        for (int i = 0; i < COUNTERS; i++) {
+            if (fds[i] != -1) {
+                ioctl(fds[i], PERF_EVENT_IOC_DISABLE, 0);
+                if (read(fds[i], &values[i], sizeof(values[i])) != sizeof(values[i]))
+                    values[i] = 0;
+            }
+        }
+#endif
+    }
+
+    bool available(Counter counter) const {
+        return fds[counter] != -1;
+    }
+
+    std::uint64_t value(Counter counter) const {
+        return values[counter];
+    }
+};
+
+/*
+ * One benchmark run: throughput together with the latency distribution
+ * and the hardware counters normalized per operation, written as a CSV
+ * row so regressions can be traced to memory behavior. Unavailable
+ * counters are written as empty fields.
+ */
+struct BenchmarkRecord {
+    std::string name;
+    int threads;
+    std::uint64_t operations;
+    double seconds;
+    LatencyHistogram latency;
+    std::vector<double> perOperation;
+
+    BenchmarkRecord(const std::string &myName, int myThreads)
+        : name(myName), threads(myThreads), operations(0), seconds(0) {}
+
+    // Record the counters of a finished run
+    void setCounters(const PerfCounters &counters) {
+        perOperation.assign(PerfCounters::COUNTERS, -1);
+        for (int i = 0; i < PerfCounters::COUNTERS; i++) {
+            PerfCounters::Counter counter = static_cast<PerfCounters::Counter>(i);
+            if (counters.available(counter) && operations > 0)
+                perOperation[i] = static_cast<double>(counters.value(counter)) / operations;
+        }
+    }
+
+    double throughput() const {
+        return seconds > 0 ? operations / seconds : 0;
+    }
+
+    static void writeCsvHeader(std::ostream &os) {
+        os << "name,threads,operations,seconds,ops_per_sec,p50_ns,p99_ns,p999_ns,max_ns,"
+              "cache_misses_per_op,llc_misses_per_op,branch_misses_per_op,instructions_per_op\n";
+    }
+
+    void writeCsv(std::ostream &os) const {
+        os << name << "," << threads << "," << operations << "," << seconds << "," << throughput() << ","
+           << latency.percentile(50) << "," << latency.percentile(99) << "," << latency.percentile(99.9) << ","
+           << latency.max();
+        for (int i = 0; i < PerfCounters::COUNTERS; i++) {
+            os << ",";
+            if (i < static_cast<int>(perOperation.size()) && perOperation[i] >= 0)
+                os << perOperation[i];
+        }
+        os << "\n";
+    }
+};
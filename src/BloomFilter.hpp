@@ -0,0 +1,84 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+/*
+ * Concurrent counting Bloom filter. Each key maps to HASHES 8-bit counters
+ * that all lie in the same 64-counter block, so a lookup touches a single
+ * cache line. Counters are updated with atomic increments and decrements,
+ * so keys can be removed as well as added; a counter that reaches 255
+ * sticks there, which can only cause false positives, never false
+ * negatives.
+ */
+template <class T>
+class CountingBloomFilter {
+   private:
+    static const std::size_t BLOCK = 64;
+    static const int HASHES = 4;
+    static const std::uint8_t SATURATED = 255;
+
+    std::vector<std::atomic<std::uint8_t>> counters;
+    std::size_t blocks;
+
+    // std::hash is the identity for integers, spread the bits first
+    static std::uint64_t mix(std::uint64_t h) {
+        h ^= h >> 33;
+        h *= 0xff51afd7ed558ccdULL;
+        h ^= h >> 33;
+        h *= 0xc4ceb9fe1a85ec53ULL;
+        h ^= h >> 33;
+        return h;
+    }
+
+    template <class Function>
+    void forEachCounter(const T &key, Function fn) {
+        std::uint64_t h = mix(std::hash<T>()(key));
+        std::atomic<std::uint8_t> *block = &counters[(h % blocks) * BLOCK];
+        std::uint64_t bits = mix(h);
+
+        for (int i = 0; i < HASHES; i++) {
+            if (!fn(block[bits % BLOCK]))
+                return;
+            bits /= BLOCK;
+        }
+    }
+
+   public:
+    // Size the filter to at least the given number of counters
+    CountingBloomFilter(std::size_t size) : counters((size / BLOCK + 1) * BLOCK), blocks(size / BLOCK + 1) {
+        for (std::atomic<std::uint8_t> &counter : counters)
+            counter.store(0, std::memory_order_relaxed);
+    }
+
+    void insert(const T &key) {
+        forEachCounter(key, [](std::atomic<std::uint8_t> &counter) {
+            std::uint8_t value = counter.load(std::memory_order_relaxed);
+            while (value != SATURATED && !counter.compare_exchange_weak(value, value + 1))
+                ;
+            return true;
+        });
+    }
+
+    void erase(const T &key) {
+        forEachCounter(key, [](std::atomic<std::uint8_t> &counter) {
+            std::uint8_t value = counter.load(std::memory_order_relaxed);
+            while (value != SATURATED && value != 0 && !counter.compare_exchange_weak(value, value - 1))
+                ;
+            return true;
+        });
+    }
+
+    // False means the key is definitely not in the set
+    bool mayContain(const T &key) {
+        bool found = true;
+        forEachCounter(key, [&](std::atomic<std::uint8_t> &counter) {
+            found = counter.load() != 0;
+            return found;
+        });
+        return found;
+    }
+};
@@ -12,6 +12,8 @@
 
 #include <mutex>
 
+#include "TryLock.hpp"
+
 template <class T>
 class CoarseGrainedList {
    private:
@@ -34,7 +36,6 @@ class CoarseGrainedList {
         Node *itr = head;
         while (itr) {
             head = head->next;
-            head->prev = nullptr;
             delete itr;
             list_size--;
             itr = head;
@@ -70,7 +71,22 @@ class CoarseGrainedList {
         return list_size;
     }
     void push_back(const T &key) {
-        std::lock_guard<std::mutex> guard(lock);
+        try_push_back(key, WAIT_FOREVER);
+    }
+
+    void pop_back() {
+        T key;
+        try_pop_back(key, WAIT_FOREVER);
+    }
+
+    /*
+     * push_back that gives up after the given number of failed attempts at
+     * the lock, for callers that can do something better than wait
+     */
+    TryResult try_push_back(const T &key, std::size_t spins = 0) {
+        std::unique_lock<std::mutex> guard(lock, std::defer_lock);
+        if (!acquire(guard, spins))
+            return TryResult::BUSY;
 
         Node *node = new Node(key);
         if (head == nullptr) {
@@ -82,24 +98,31 @@ class CoarseGrainedList {
             tail = node;
         }
         list_size++;
+        return TryResult::SUCCEEDED;
     }
 
-    void pop_back() {
-        std::lock_guard<std::mutex> guard(lock);
+    /*
+     * Take the last key into key and pop it, so back() and pop_back() are
+     * one step for stack-like use. Fails if the list is empty.
+     */
+    TryResult try_pop_back(T &key, std::size_t spins = 0) {
+        std::unique_lock<std::mutex> guard(lock, std::defer_lock);
+        if (!acquire(guard, spins))
+            return TryResult::BUSY;
 
-        if (head && tail) {
-            if (head == tail) {
-                delete head;
-                head = nullptr;
-                tail = nullptr;
-            } else {
-                Node *itr = tail;
-                tail = tail->prev;
-                tail->next = nullptr;
-                delete itr;
-            }
-            list_size--;
-        }
+        if (tail == nullptr)
+            return TryResult::FAILED;
+
+        Node *itr = tail;
+        key = itr->key;
+        tail = itr->prev;
+        if (tail == nullptr)
+            head = nullptr;
+        else
+            tail->next = nullptr;
+        delete itr;
+        list_size--;
+        return TryResult::SUCCEEDED;
     }
 
     friend std::ostream &operator<<(std::ostream &os, const CoarseGrainedList &list) {
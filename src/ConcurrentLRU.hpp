@@ -0,0 +1,307 @@
+/*************************************************************************
+ * Concurrent LRU Cache
+ *
+ * A capacity-bounded cache combining a sharded hash index with a recency
+ * list made of doubly-linked nodes between head and tail sentinels, laid
+ * out like the Fine-Grained list. Lookups only lock the shard holding the
+ * key. Instead of moving the entry to the front of the recency list on
+ * every hit, the hit is recorded in a per-thread buffer and buffered hits
+ * are applied in one batch under the list lock once a buffer fills up.
+ * While a buffer stays full, every hit on it tries the list lock again
+ * until one drains it. A hit whose buffer is busy is dropped, since
+ * recency only needs to be approximately right. Inserting a new key and
+ * evicting the least recently used one take the list lock and are O(1).
+ *
+ * **********************************************************************/
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <functional>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+template <class K, class V>
+class ConcurrentLRU {
+   public:
+    ConcurrentLRU(std::size_t);
+    ~ConcurrentLRU();
+    bool get(const K &, V &);
+    void put(const K &, const V &);
+    bool erase(const K &);
+    std::size_t size() const;
+
+   private:
+    struct Node {
+        K key;
+        V value;
+        Node *prev;
+        Node *next;
+
+        Node() : key(K()), value(V()), prev(nullptr), next(nullptr) {}
+        Node(const K &key, const V &value) : key(key), value(value), prev(nullptr), next(nullptr) {}
+    };
+
+    struct alignas(64) Shard {
+        std::mutex lock;
+        std::unordered_map<K, Node *> map;
+    };
+
+    // Hits recorded by the threads assigned to this buffer, not yet applied
+    // to the recency list
+    struct alignas(64) Buffer {
+        std::mutex lock;
+        std::vector<K> keys;
+    };
+
+    static const std::size_t SHARDS = 16;
+    static const std::size_t BUFFERS = 16;
+    static const std::size_t BUFFER_SIZE = 64;
+
+    Shard shards[SHARDS];
+    Buffer buffers[BUFFERS];
+    Node *head;
+    Node *tail;
+    std::mutex listLock;
+    std::size_t capacity;
+    std::atomic<std::size_t> entries;
+
+    Shard &shardOf(const K &);
+    static std::size_t bufferIndex();
+    void recordHit(const K &);
+    void drain();
+    void promote(const K &);
+    void unlink(Node *);
+    void pushFront(Node *);
+};
+
+/*
+ * Create an empty cache holding at most capacity entries
+ */
+template <class K, class V>
+ConcurrentLRU<K, V>::ConcurrentLRU(std::size_t myCapacity) : capacity(myCapacity ? myCapacity : 1), entries(0) {
+    head = new Node();
+    tail = new Node();
+    head->next = tail;
+    tail->prev = head;
+}
+
+template <class K, class V>
+ConcurrentLRU<K, V>::~ConcurrentLRU() {
+    Node *itr = head;
+    while (itr) {
+        Node *next = itr->next;
+        delete itr;
+        itr = next;
+    }
+}
+
+/*
+ * Copy the value cached for key into value and record the hit. Returns
+ * false on a miss.
+ */
+template <class K, class V>
+bool ConcurrentLRU<K, V>::get(const K &key, V &value) {
+    {
+        Shard &shard = shardOf(key);
+        std::lock_guard<std::mutex> guard(shard.lock);
+
+        auto itr = shard.map.find(key);
+        if (itr == shard.map.end())
+            return false;
+        value = itr->second->value;
+    }
+    recordHit(key);
+    return true;
+}
+
+/*
+ * Cache value for key, evicting the least recently used entries if the
+ * cache is over capacity
+ */
+template <class K, class V>
+void ConcurrentLRU<K, V>::put(const K &key, const V &value) {
+    Shard &shard = shardOf(key);
+
+    // Updating an existing entry only needs its shard
+    bool cached = false;
+    {
+        std::lock_guard<std::mutex> guard(shard.lock);
+
+        auto itr = shard.map.find(key);
+        if (itr != shard.map.end()) {
+            itr->second->value = value;
+            cached = true;
+        }
+    }
+    if (cached) {
+        recordHit(key);
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> guard(listLock);
+
+        // Apply pending hits first so eviction sees up to date recency
+        drain();
+
+        {
+            std::lock_guard<std::mutex> sharding(shard.lock);
+
+            auto itr = shard.map.find(key);
+            if (itr != shard.map.end()) {
+                // Inserted by another thread in the meantime
+                itr->second->value = value;
+                unlink(itr->second);
+                pushFront(itr->second);
+                return;
+            }
+
+            Node *node = new Node(key, value);
+            shard.map.emplace(key, node);
+            pushFront(node);
+            entries++;
+        }
+
+        while (entries > capacity) {
+            Node *victim = tail->prev;
+            Shard &owner = shardOf(victim->key);
+            {
+                std::lock_guard<std::mutex> sharding(owner.lock);
+                owner.map.erase(victim->key);
+            }
+            unlink(victim);
+            delete victim;
+            entries--;
+        }
+    }
+}
+
+/*
+ * Remove key from the cache. Returns false if it was not cached.
+ */
+template <class K, class V>
+bool ConcurrentLRU<K, V>::erase(const K &key) {
+    std::lock_guard<std::mutex> guard(listLock);
+
+    Node *node;
+    {
+        Shard &shard = shardOf(key);
+        std::lock_guard<std::mutex> sharding(shard.lock);
+
+        auto itr = shard.map.find(key);
+        if (itr == shard.map.end())
+            return false;
+        node = itr->second;
+        shard.map.erase(itr);
+    }
+    unlink(node);
+    delete node;
+    entries--;
+    return true;
+}
+
+template <class K, class V>
+std::size_t ConcurrentLRU<K, V>::size() const {
+    return entries;
+}
+
+template <class K, class V>
+typename ConcurrentLRU<K, V>::Shard &ConcurrentLRU<K, V>::shardOf(const K &key) {
+    return shards[std::hash<K>()(key) % SHARDS];
+}
+
+/*
+ * Threads are assigned hit buffers round-robin on their first hit
+ */
+template <class K, class V>
+std::size_t ConcurrentLRU<K, V>::bufferIndex() {
+    static std::atomic<std::size_t> next(0);
+    thread_local std::size_t index = next.fetch_add(1, std::memory_order_relaxed) % BUFFERS;
+    return index;
+}
+
+/*
+ * Buffer a hit on key. When the buffer is full, apply every buffered hit
+ * and this one if the list lock is free; otherwise whoever holds it, or
+ * the next hit on this buffer, will. Only a hit that finds the buffer
+ * itself busy is dropped.
+ */
+template <class K, class V>
+void ConcurrentLRU<K, V>::recordHit(const K &key) {
+    Buffer &buffer = buffers[bufferIndex()];
+    bool buffered = false;
+    {
+        std::unique_lock<std::mutex> guard(buffer.lock, std::try_to_lock);
+        if (!guard.owns_lock())
+            return;
+
+        if (buffer.keys.size() < BUFFER_SIZE) {
+            buffer.keys.push_back(key);
+            if (buffer.keys.size() < BUFFER_SIZE)
+                return;
+            buffered = true;
+        }
+    }
+
+    std::unique_lock<std::mutex> guard(listLock, std::try_to_lock);
+    if (!guard.owns_lock())
+        return;
+
+    drain();
+    // A hit that found the buffer full was not buffered, apply it here
+    if (!buffered)
+        promote(key);
+}
+
+/*
+ * Move the entries of every buffered hit to the front of the recency list.
+ * Called with the list lock held.
+ */
+template <class K, class V>
+void ConcurrentLRU<K, V>::drain() {
+    std::vector<K> keys;
+
+    for (Buffer &buffer : buffers) {
+        {
+            std::lock_guard<std::mutex> guard(buffer.lock);
+            keys.swap(buffer.keys);
+        }
+
+        for (const K &key : keys)
+            promote(key);
+        keys.clear();
+    }
+}
+
+/*
+ * Move the entry of key to the front of the recency list. Called with the
+ * list lock held.
+ */
+template <class K, class V>
+void ConcurrentLRU<K, V>::promote(const K &key) {
+    Shard &shard = shardOf(key);
+    std::lock_guard<std::mutex> guard(shard.lock);
+
+    // The entry may have been evicted since the hit
+    auto itr = shard.map.find(key);
+    if (itr != shard.map.end()) {
+        unlink(itr->second);
+        pushFront(itr->second);
+    }
+}
+
+template <class K, class V>
+void ConcurrentLRU<K, V>::unlink(Node *node) {
+    node->prev->next = node->next;
+    node->next->prev = node->prev;
+}
+
+template <class K, class V>
+void ConcurrentLRU<K, V>::pushFront(Node *node) {
+    node->prev = head;
+    node->next = head->next;
+    head->next->prev = node;
+    head->next = node;
+}
@@ -0,0 +1,157 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <random>
+#include <thread>
+
+/*
+ * An array of exchanger slots where a push and a pop that collide cancel
+ * out: the pusher hands its value straight to the popper and neither
+ * touches the underlying structure. A thread picks a slot at random among
+ * the first range slots. If the slot is empty it leaves an offer there and
+ * waits a bounded number of rounds for a partner; if the slot holds an
+ * offer of the opposite kind it claims it and completes the exchange.
+ *
+ * The range grows when threads collide on slots and shrinks when offers
+ * time out, so the array spreads out under heavy load and stays small,
+ * where partners are easy to find, under light load.
+ */
+template <class T>
+class EliminationArray {
+   public:
+    static const std::size_t DEFAULT_SLOTS = 16;
+    static const std::size_t DEFAULT_PATIENCE = 64;
+
+    EliminationArray(std::size_t = DEFAULT_SLOTS, std::size_t = DEFAULT_PATIENCE);
+    bool push(const T &);
+    bool pop(T &);
+
+   private:
+    // Lives on the offering thread's stack until done is set
+    struct Offer {
+        T value;
+        alignas(2) std::atomic<bool> done;
+
+        Offer() : value(), done(false) {}
+        Offer(const T &value) : value(value), done(false) {}
+    };
+
+    // A slot holds the address of an offer with its kind in the low bit,
+    // so an offer withdrawn and reposted at the same address as the other
+    // kind cannot be claimed by a stale partner
+    struct alignas(64) Slot {
+        std::atomic<std::uintptr_t> offer;
+        Slot() : offer(0) {}
+    };
+
+    static const std::uintptr_t PUSH = 1;
+
+    std::unique_ptr<Slot[]> slots;
+    std::size_t capacity;
+    std::size_t patience;
+    std::atomic<std::size_t> range;
+
+    bool exchange(Offer &, bool);
+    void grow();
+    void shrink();
+};
+
+/*
+ * Create an array of the given number of slots, where an offer waits the
+ * given number of rounds for a partner before it is withdrawn
+ */
+template <class T>
+EliminationArray<T>::EliminationArray(std::size_t mySlots, std::size_t myPatience)
+    : slots(new Slot[mySlots ? mySlots : 1]), capacity(mySlots ? mySlots : 1), patience(myPatience), range(1) {}
+
+/*
+ * Hand key to a concurrent pop(). Returns false if no pop came along in
+ * time, in which case the caller still owns key.
+ */
+template <class T>
+bool EliminationArray<T>::push(const T &key) {
+    Offer mine(key);
+    return exchange(mine, true);
+}
+
+/*
+ * Take a key from a concurrent push() into key. Returns false if no push
+ * came along in time.
+ */
+template <class T>
+bool EliminationArray<T>::pop(T &key) {
+    Offer mine;
+    if (!exchange(mine, false))
+        return false;
+    key = mine.value;
+    return true;
+}
+
+template <class T>
+bool EliminationArray<T>::exchange(Offer &mine, bool pushing) {
+    thread_local std::minstd_rand random(std::random_device{}());
+
+    Slot &slot = slots[random() % range.load(std::memory_order_relaxed)];
+    std::uintptr_t posted = reinterpret_cast<std::uintptr_t>(&mine) | (pushing ? PUSH : 0);
+    std::uintptr_t theirs = slot.offer.load(std::memory_order_acquire);
+
+    if (theirs == 0) {
+        if (!slot.offer.compare_exchange_strong(theirs, posted, std::memory_order_acq_rel)) {
+            grow();
+            return false;
+        }
+
+        for (std::size_t i = 0; i < patience; i++) {
+            if (mine.done.load(std::memory_order_acquire))
+                return true;
+            std::this_thread::yield();
+        }
+
+        // Withdraw the offer, unless a partner claimed it in the meantime
+        std::uintptr_t expected = posted;
+        if (slot.offer.compare_exchange_strong(expected, 0, std::memory_order_acq_rel)) {
+            shrink();
+            return false;
+        }
+        while (!mine.done.load(std::memory_order_acquire))
+            std::this_thread::yield();
+        return true;
+    }
+
+    // Two pushes or two pops cannot help each other
+    if (((theirs & PUSH) != 0) == pushing) {
+        grow();
+        return false;
+    }
+
+    if (!slot.offer.compare_exchange_strong(theirs, 0, std::memory_order_acq_rel)) {
+        grow();
+        return false;
+    }
+
+    // The offer is ours alone now and its owner waits for done
+    Offer *partner = reinterpret_cast<Offer *>(theirs & ~PUSH);
+    if (pushing)
+        partner->value = mine.value;
+    else
+        mine.value = partner->value;
+    partner->done.store(true, std::memory_order_release);
+    return true;
+}
+
+template <class T>
+void EliminationArray<T>::grow() {
+    std::size_t current = range.load(std::memory_order_relaxed);
+    if (current < capacity)
+        range.compare_exchange_weak(current, current + 1, std::memory_order_relaxed);
+}
+
+template <class T>
+void EliminationArray<T>::shrink() {
+    std::size_t current = range.load(std::memory_order_relaxed);
+    if (current > 1)
+        range.compare_exchange_weak(current, current - 1, std::memory_order_relaxed);
+}
@@ -0,0 +1,77 @@
+/*************************************************************************
+ * Elimination Backoff List
+ *
+ * A list used as a stack through push_back() and pop_back(), with an
+ * elimination array in front of it. Each call first tries the list
+ * without waiting for its lock. When the lock is busy, the call backs off
+ * to the elimination array instead of queueing on the tail, where a push
+ * and a pop that meet exchange the value directly and neither touches the
+ * list. A push followed at once by the pop that removes it leaves the
+ * stack as it was, so the pair can be taken out of the list's history.
+ * Calls that find no partner in time go back to the list.
+ *
+ * Works with any list that has try_push_back() and try_pop_back(), such
+ * as CoarseGrainedList and FineGrainedList.
+ *
+ * **********************************************************************/
+#pragma once
+
+#include "CoarseGrainedList.hpp"
+#include "EliminationArray.hpp"
+#include "TryLock.hpp"
+
+template <class T, class List = CoarseGrainedList<T>>
+class EliminationBackoffList {
+   public:
+    EliminationBackoffList(std::size_t = EliminationArray<T>::DEFAULT_SLOTS,
+                           std::size_t = EliminationArray<T>::DEFAULT_PATIENCE);
+    void push_back(const T &);
+    bool pop_back(T &);
+    bool empty() const;
+    std::size_t size() const;
+
+   private:
+    List list;
+    EliminationArray<T> elimination;
+};
+
+/*
+ * slots and patience size the elimination array, see EliminationArray
+ */
+template <class T, class List>
+EliminationBackoffList<T, List>::EliminationBackoffList(std::size_t slots, std::size_t patience)
+    : elimination(slots, patience) {}
+
+template <class T, class List>
+void EliminationBackoffList<T, List>::push_back(const T &key) {
+    while (true) {
+        if (list.try_push_back(key) == TryResult::SUCCEEDED)
+            return;
+        if (elimination.push(key))
+            return;
+    }
+}
+
+/*
+ * Remove the last key into key. Returns false if the list was empty.
+ */
+template <class T, class List>
+bool EliminationBackoffList<T, List>::pop_back(T &key) {
+    while (true) {
+        TryResult result = list.try_pop_back(key);
+        if (result != TryResult::BUSY)
+            return result == TryResult::SUCCEEDED;
+        if (elimination.pop(key))
+            return true;
+    }
+}
+
+template <class T, class List>
+bool EliminationBackoffList<T, List>::empty() const {
+    return list.empty();
+}
+
+template <class T, class List>
+std::size_t EliminationBackoffList<T, List>::size() const {
+    return list.size();
+}
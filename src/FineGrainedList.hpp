@@ -16,6 +16,9 @@
 #include <iostream>
 #include <mutex>
 
+#include "LockProfiler.hpp"
+#include "TryLock.hpp"
+
 template <class T>
 class FineGrainedList {
    public:
@@ -27,6 +30,8 @@ class FineGrainedList {
     int size() const;
     void push_back(const T &);
     void pop_back();
+    TryResult try_push_back(const T &, std::size_t = 0);
+    TryResult try_pop_back(T &, std::size_t = 0);
     void print_forwards();
     void print_backwards();
 
@@ -35,20 +40,25 @@ class FineGrainedList {
         T key;
         Node *prev;
         Node *next;
-        mutable std::mutex lock;
+        mutable NodeMutex lock;
 
         Node() : key(T()), prev(nullptr), next(nullptr) {}
         Node(T key) : key(key), prev(nullptr), next(nullptr) {}
         Node(T key, Node *prev, Node *next) : key(key), prev(prev), next(next) {}
     };
-    atomic<int> list_size;
+    std::atomic<int> list_size;
     Node *head;
     Node *tail;
     void delete_list();
 };
 
+/*
+ * head and tail are sentinels that hold no key. Every update locks the tail
+ * first and then the node whose next link it changes, so locks are always
+ * taken from the back of the list towards the front.
+ */
 template <class T>
-FineGrainedList<T>::FineGrainedList() {
+FineGrainedList<T>::FineGrainedList() : list_size(0) {
     head = new Node();
     tail = new Node();
     head->next = tail;
@@ -57,25 +67,29 @@ FineGrainedList<T>::FineGrainedList() {
 
 template <class T>
 FineGrainedList<T>::~FineGrainedList() {
-    deleteList();
+    delete_list();
 }
 
+/*
+ * The first node cannot be unlinked while head is locked
+ */
 template <class T>
 T FineGrainedList<T>::front() const {
-    if (head->next) {
-        std::lock_guard<std::mutex> guard(head->next);
-        return head->next->key;
-    }
-    return T();
+    PROFILE_LOCKS(CONTAINS);
+
+    std::lock_guard<NodeMutex> guard(head->lock);
+    return head->next != tail ? head->next->key : T();
 }
 
+/*
+ * The last node cannot be unlinked while tail is locked
+ */
 template <class T>
 T FineGrainedList<T>::back() const {
-    if (tail) {
-        std::lock_guard<std::mutex> guard(tail);
-        return tail->key;
-    }
-    return T();
+    PROFILE_LOCKS(CONTAINS);
+
+    std::lock_guard<NodeMutex> guard(tail->lock);
+    return tail->prev != head ? tail->prev->key : T();
 }
 
 template <class T>
@@ -88,49 +102,75 @@ int FineGrainedList<T>::size() const {
     return list_size;
 }
 
-
 template <class T>
 void FineGrainedList<T>::push_back(const T &key) {
-    Node *node = new Node(key);
-    std::scoped_lock<std::mutex> lock(head, tail);
-
-    if (head->next == nullptr) {
-        head->next = node;
-        node->prev = head;
-        tail->prev = node;
-        node->next = tail;
-    } else {
-        tail->prev->next = node;
-        node->prev = tail->prev;
-        tail->prev = node;
-        node->next = tail;
-    }
-    list_size++;
+    try_push_back(key, WAIT_FOREVER);
 }
 
 template <class T>
 void FineGrainedList<T>::pop_back() {
-    std::scoped_lock<std::mutex> lock(head, tail);
-
-    if (head->next && tail->prev) {
-        if (head->next == tail->prev) {
-            delete head->next;
-            head->next = nullptr;
-            tail- = nullptr;
-        } else {
-            Node *itr = tail;
-            tail = tail->prev;
-            tail->next = nullptr;
-            delete itr;
-        }
-        list_size--;
-    }
+    T key;
+    try_pop_back(key, WAIT_FOREVER);
+}
+
+/*
+ * push_back that gives up after the given number of failed attempts at the
+ * tail's lock and its neighbour's together, for callers that can do
+ * something better than wait
+ */
+template <class T>
+TryResult FineGrainedList<T>::try_push_back(const T &key, std::size_t spins) {
+    PROFILE_LOCKS(ADD, key);
+
+    std::unique_lock<NodeMutex> tailGuard(tail->lock, std::defer_lock);
+    if (!acquire(tailGuard, spins))
+        return TryResult::BUSY;
+
+    Node *last = tail->prev;
+    std::unique_lock<NodeMutex> lastGuard(last->lock, std::defer_lock);
+    if (!acquire(lastGuard, spins))
+        return TryResult::BUSY;
+
+    Node *node = new Node(key, last, tail);
+    last->next = node;
+    tail->prev = node;
+    list_size++;
+    return TryResult::SUCCEEDED;
+}
+
+/*
+ * Take the last key into key and pop it, so back() and pop_back() are one
+ * step for stack-like use. Fails if the list is empty.
+ */
+template <class T>
+TryResult FineGrainedList<T>::try_pop_back(T &key, std::size_t spins) {
+    PROFILE_LOCKS(REMOVE);
+
+    std::unique_lock<NodeMutex> tailGuard(tail->lock, std::defer_lock);
+    if (!acquire(tailGuard, spins))
+        return TryResult::BUSY;
+
+    Node *last = tail->prev;
+    if (last == head)
+        return TryResult::FAILED;
+
+    Node *pred = last->prev;
+    std::unique_lock<NodeMutex> predGuard(pred->lock, std::defer_lock);
+    if (!acquire(predGuard, spins))
+        return TryResult::BUSY;
+
+    key = last->key;
+    pred->next = tail;
+    tail->prev = pred;
+    list_size--;
+    delete last;
+    return TryResult::SUCCEEDED;
 }
 
 template <class T>
 void FineGrainedList<T>::print_forwards() {
-    Node *itr = head;
-    while (itr) {
+    Node *itr = head->next;
+    while (itr != tail) {
         std::cout << itr->key << " ";
         itr = itr->next;
     }
@@ -139,8 +179,8 @@ void FineGrainedList<T>::print_forwards() {
 
 template <class T>
 void FineGrainedList<T>::print_backwards() {
-    Node *itr = tail;
-    while (itr) {
+    Node *itr = tail->prev;
+    while (itr != head) {
         std::cout << itr->key << " ";
         itr = itr->prev;
     }
@@ -152,11 +192,10 @@ void FineGrainedList<T>::delete_list() {
     Node *itr = head;
     while (itr) {
         head = head->next;
-        head->prev = nullptr;
         delete itr;
-        list_size--;
         itr = head;
     }
+    list_size = 0;
     head = nullptr;
     tail = nullptr;
 }
@@ -0,0 +1,276 @@
+/*************************************************************************
+ * Frozen Set
+ *
+ * An immutable snapshot of a set for read-only phases: the keys in one
+ * contiguous array, searched without chasing pointers. In the SORTED
+ * layout the array is in key order and searched with a branchless binary
+ * search. In the EYTZINGER layout the array holds the keys in the order
+ * of a breadth-first walk of the implicit search tree, so the first
+ * levels of every search share the same few cache lines and the next
+ * level can be prefetched before it is needed.
+ *
+ * A frozen set of trivially copyable keys can be saved to a file and
+ * later memory-mapped back, so a restarted process can answer lookups
+ * without rebuilding anything.
+ *
+ * **********************************************************************/
+#pragma once
+
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <functional>
+#include <string>
+#include <system_error>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "NodeKey.hpp"
+#include "Prefetch.hpp"
+
+template <class T, class Compare = std::less<T>>
+class FrozenSet {
+   public:
+    enum Layout { SORTED, EYTZINGER };
+
+    FrozenSet();
+    FrozenSet(std::vector<T>, Layout = SORTED);
+    FrozenSet(FrozenSet &&);
+    FrozenSet &operator=(FrozenSet &&);
+    ~FrozenSet();
+    FrozenSet(const FrozenSet &) = delete;
+    FrozenSet &operator=(const FrozenSet &) = delete;
+    bool contains(const T &) const;
+    std::size_t size() const;
+    Layout layout() const;
+    void save(const std::string &) const;
+    static FrozenSet load(const std::string &);
+
+   private:
+    struct Header {
+        std::uint64_t magic;
+        std::uint64_t keyBytes;
+        std::uint64_t layout;
+        std::uint64_t count;
+    };
+
+    static const std::uint64_t MAGIC = 0x46524f5a454e5354ULL;
+
+    // The Eytzinger array is 1-based, slot 0 is unused
+    const T *keys;
+    std::size_t count;
+    Layout order;
+    std::vector<T> owned;
+    void *mapping;
+    std::size_t mappedLength;
+
+    static std::size_t dataOffset() {
+        return (sizeof(Header) + alignof(T) - 1) / alignof(T) * alignof(T);
+    }
+
+    std::size_t slots() const {
+        return order == EYTZINGER ? count + 1 : count;
+    }
+
+    std::size_t fill(const std::vector<T> &, std::size_t, std::size_t);
+    void release();
+};
+
+template <class T, class Compare>
+FrozenSet<T, Compare>::FrozenSet() : keys(NULL), count(0), order(SORTED), mapping(NULL), mappedLength(0) {}
+
+/*
+ * Freeze the given keys, which must be unique and sorted by Compare
+ */
+template <class T, class Compare>
+FrozenSet<T, Compare>::FrozenSet(std::vector<T> sorted, Layout myLayout)
+    : count(sorted.size()), order(myLayout), mapping(NULL), mappedLength(0) {
+    if (order == SORTED) {
+        owned = std::move(sorted);
+    } else {
+        owned.resize(count + 1);
+        fill(sorted, 0, 1);
+    }
+    keys = owned.data();
+}
+
+template <class T, class Compare>
+FrozenSet<T, Compare>::FrozenSet(FrozenSet &&other)
+    : keys(other.keys),
+      count(other.count),
+      order(other.order),
+      owned(std::move(other.owned)),
+      mapping(other.mapping),
+      mappedLength(other.mappedLength) {
+    other.keys = NULL;
+    other.count = 0;
+    other.mapping = NULL;
+    other.mappedLength = 0;
+}
+
+template <class T, class Compare>
+FrozenSet<T, Compare> &FrozenSet<T, Compare>::operator=(FrozenSet &&other) {
+    if (this != &other) {
+        release();
+        keys = other.keys;
+        count = other.count;
+        order = other.order;
+        owned = std::move(other.owned);
+        mapping = other.mapping;
+        mappedLength = other.mappedLength;
+        other.keys = NULL;
+        other.count = 0;
+        other.mapping = NULL;
+        other.mappedLength = 0;
+    }
+    return *this;
+}
+
+template <class T, class Compare>
+FrozenSet<T, Compare>::~FrozenSet() {
+    release();
+}
+
+/*
+ * Both searches select the next position with a conditional move rather
+ * than a branch, so mispredictions do not stall the pipeline.
+ */
+template <class T, class Compare>
+bool FrozenSet<T, Compare>::contains(const T &key) const {
+    if (count == 0)
+        return false;
+
+    if (order == EYTZINGER) {
+        std::size_t k = 1;
+        while (k <= count) {
+            // The four levels below k share one or two cache lines
+            prefetch(keys + 16 * k);
+            k = 2 * k + Compare()(keys[k], key);
+        }
+        // Undo the right turns taken after the last left turn
+        k >>= __builtin_ffsll(~k);
+        return k != 0 && KeyEqual<T, Compare>()(keys[k], key);
+    }
+
+    // Find the last key not greater than key
+    const T *base = keys;
+    std::size_t n = count;
+    while (n > 1) {
+        std::size_t half = n / 2;
+        base = Compare()(key, base[half]) ? base : base + half;
+        n -= half;
+    }
+    return KeyEqual<T, Compare>()(*base, key);
+}
+
+template <class T, class Compare>
+std::size_t FrozenSet<T, Compare>::size() const {
+    return count;
+}
+
+template <class T, class Compare>
+typename FrozenSet<T, Compare>::Layout FrozenSet<T, Compare>::layout() const {
+    return order;
+}
+
+/*
+ * Write the set to a file that load() can map back. Throws
+ * std::system_error if the file cannot be written.
+ */
+template <class T, class Compare>
+void FrozenSet<T, Compare>::save(const std::string &path) const {
+    static_assert(std::is_trivially_copyable<T>::value, "only trivially copyable keys can be saved");
+
+    std::FILE *file = std::fopen(path.c_str(), "wb");
+    if (file == NULL)
+        throw std::system_error(errno, std::generic_category(), "open " + path);
+
+    Header header = {MAGIC, sizeof(T), static_cast<std::uint64_t>(order), count};
+    std::vector<char> padding(dataOffset() - sizeof(Header), 0);
+
+    bool written = std::fwrite(&header, sizeof(header), 1, file) == 1 &&
+                   (padding.empty() || std::fwrite(padding.data(), 1, padding.size(), file) == padding.size()) &&
+                   (slots() == 0 || std::fwrite(keys, sizeof(T), slots(), file) == slots());
+    if (std::fclose(file) != 0 || !written)
+        throw std::system_error(errno ? errno : EIO, std::generic_category(), "write " + path);
+}
+
+/*
+ * Map a set written by save(). Lookups read the file's pages directly, so
+ * only the pages a lookup touches are ever read from disk. Throws
+ * std::system_error if the file cannot be mapped or was not written by
+ * save() for the same key type.
+ */
+template <class T, class Compare>
+FrozenSet<T, Compare> FrozenSet<T, Compare>::load(const std::string &path) {
+    static_assert(std::is_trivially_copyable<T>::value, "only trivially copyable keys can be loaded");
+
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd == -1)
+        throw std::system_error(errno, std::generic_category(), "open " + path);
+
+    struct stat info;
+    if (fstat(fd, &info) == -1) {
+        int error = errno;
+        close(fd);
+        throw std::system_error(error, std::generic_category(), "fstat " + path);
+    }
+
+    std::size_t length = info.st_size;
+    if (length < dataOffset()) {
+        close(fd);
+        throw std::system_error(EINVAL, std::generic_category(), "frozen set " + path);
+    }
+
+    void *mapped = mmap(NULL, length, PROT_READ, MAP_SHARED, fd, 0);
+    int error = errno;
+    close(fd);
+    if (mapped == MAP_FAILED)
+        throw std::system_error(error, std::generic_category(), "mmap " + path);
+
+    FrozenSet frozen;
+    frozen.mapping = mapped;
+    frozen.mappedLength = length;
+
+    const Header *header = static_cast<const Header *>(mapped);
+    frozen.count = header->count;
+    frozen.order = header->layout == EYTZINGER ? EYTZINGER : SORTED;
+    frozen.keys = reinterpret_cast<const T *>(static_cast<const char *>(mapped) + dataOffset());
+
+    if (header->magic != MAGIC || header->keyBytes != sizeof(T) || header->layout > EYTZINGER ||
+        length != dataOffset() + frozen.slots() * sizeof(T))
+        throw std::system_error(EINVAL, std::generic_category(), "frozen set " + path);
+
+    return frozen;
+}
+
+/*
+ * Place the sorted keys from index i on into the subtree rooted at slot k
+ * with an in-order walk. Returns the index of the next key to place.
+ */
+template <class T, class Compare>
+std::size_t FrozenSet<T, Compare>::fill(const std::vector<T> &sorted, std::size_t i, std::size_t k) {
+    if (k <= count) {
+        i = fill(sorted, i, 2 * k);
+        owned[k] = sorted[i++];
+        i = fill(sorted, i, 2 * k + 1);
+    }
+    return i;
+}
+
+template <class T, class Compare>
+void FrozenSet<T, Compare>::release() {
+    if (mapping != NULL)
+        munmap(mapping, mappedLength);
+    mapping = NULL;
+    mappedLength = 0;
+    owned.clear();
+    keys = NULL;
+    count = 0;
+}
@@ -13,85 +13,234 @@
  * thread does not find a node, or finds it marked, then the item is not
  * in the set.
  *
+ * Keys are kept in the order given by Compare. The head and tail
+ * sentinels hold no key and are recognized by address, so every value of
+ * the key type can be stored. Every list of the same key type and order
+ * ends at one shared tail, so chains can move between lists by relinking
+ * a single node, see splitAt() and concat().
+ *
  * **********************************************************************/
 #pragma once
 
+#include <algorithm>
+#include <atomic>
+#include <functional>
 #include <iostream>
+#include <memory>
 #include <mutex>
+#include <thread>
+#include <vector>
+
+#include "BloomFilter.hpp"
+#include "FrozenSet.hpp"
+#include "LockProfiler.hpp"
+#include "NodeKey.hpp"
+#include "ParallelSegments.hpp"
+#include "Prefetch.hpp"
+#include "StripedCounter.hpp"
+#include "TryLock.hpp"
 
-template <class T>
+template <class T, class Compare = std::less<T>>
 class LazyList {
    public:
     LazyList();
+    template <class InputIt>
+    LazyList(InputIt, InputIt);
     ~LazyList();
     bool contains(T);
     bool add(T);
     bool remove(T);
+    TryResult tryAdd(T, std::size_t = DEFAULT_SPINS);
+    TryResult tryRemove(T, std::size_t = DEFAULT_SPINS);
+    std::size_t size() const;
+    std::size_t sizeExact() const;
+    template <class Function>
+    void parallelForEach(std::size_t, Function);
+    template <class R, class Reduce, class Combine>
+    R parallelReduce(std::size_t, R, Reduce, Combine);
+    template <class InputIt>
+    void assign(InputIt, InputIt);
+    void clear();
+    bool splitAt(T, LazyList &);
+    bool concat(LazyList &);
+    void compact();
+    void setDeferredUnlink(bool);
+    std::size_t sweep();
+    void enableIndex(std::size_t);
+    void rebuildIndex();
+    void enableFilter(std::size_t);
+    FrozenSet<T, Compare> freeze(typename FrozenSet<T, Compare>::Layout = FrozenSet<T, Compare>::SORTED);
+    void reclaim();
     void printList();
     void deleteList();
 
+    static const std::size_t DEFAULT_SPINS = 64;
+
    private:
+    typedef typename NodeKey<T, Compare>::Probe Probe;
+
     struct Node {
-        T key;
-        bool marked;
+        NodeKey<T, Compare> key;
+        // Read without the node's lock by contains() and traversals
+        std::atomic<bool> marked;
+        // Marked because compact() moved the key to a new node. Set before
+        // marked, so a reader that sees the mark also sees this.
+        std::atomic<bool> relocated{false};
+        // Allocated inside a compaction chunk rather than on its own
+        bool pooled = false;
         Node *next;
-        mutex lock;
+        NodeMutex lock;
+    };
+    /*
+     * Sampled shortcut index: every stride-th unmarked node, in key order,
+     * as of the last rebuild. built is the list size at that time. skipped
+     * counts removed entries that lookups stepped over, and updates the
+     * updates made since the rebuild, see refreshIndex().
+     */
+    struct Index {
+        std::vector<Node *> entries;
+        std::size_t built;
+        std::atomic<std::size_t> skipped{0};
+        std::atomic<std::size_t> updates{0};
     };
+    static const std::size_t CHUNK = 64;
     Node *head;
     Node *tail;
+    // The last node as of the latest update at the end, see lockLast()
+    std::atomic<Node *> last{NULL};
+    // Set once splitAt() or concat() moved nodes the counters did not see
+    std::atomic<bool> recount{false};
+    // Added to the counters by size() until then, see sizeExact()
+    mutable std::atomic<long> drift{0};
+    std::vector<Node *> retired;
+    std::vector<Node *> relocated;
+    // Chunks allocated by compact(), shared with lists that nodes were
+    // moved to, and those of lists that nodes were moved in from
+    typedef std::vector<std::unique_ptr<Node[]>> Chunks;
+    std::shared_ptr<Chunks> chunks = std::make_shared<Chunks>();
+    std::vector<std::shared_ptr<Chunks>> borrowed;
+    std::mutex compactLock;
+    std::atomic<Index *> index{NULL};
+    std::atomic<std::size_t> indexStride{0};
+    // Threads reading the index, counted on the side they entered on, see
+    // publishIndex()
+    std::atomic<unsigned> indexSide{0};
+    StripedCounter indexReaders[2];
+    std::mutex indexLock;
+    std::atomic<CountingBloomFilter<T> *> filter{NULL};
+    // Filter being built by enableFilter(), which add() fills as well
+    std::atomic<CountingBloomFilter<T> *> filling{NULL};
+    std::vector<CountingBloomFilter<T> *> retiredFilters;
+    std::atomic<bool> deferred{false};
+    StripedCounter count;
+    static Node *sharedTail();
     bool validate(Node *, Node *);
+    void unlock(Node *, Node *);
+    std::size_t unlinkMarked(Node *);
+    Node *lockLast();
+    void moveLast(Node *, Node *);
+    std::size_t walkCount() const;
+    void dropFilter();
+    long markChain();
+    Node *start(const Probe &);
+    void refreshIndex();
+    void filterInsert(const T &);
+    void filterErase(const T &);
+    void buildIndex();
+    void publishIndex(Index *);
+    unsigned enterIndex();
+    void leaveIndex(unsigned);
+    template <class InputIt>
+    Node *link(InputIt, InputIt, long &, Node *&);
+    void freeChain(Node *);
+    void shareChunks(LazyList &);
+    std::vector<Node *> sample(std::size_t);
+    template <class Function>
+    void forEachInSegment(const std::vector<Node *> &, std::size_t, Function);
 };
 
 /*************************************************************************
  * Initialize class variables
- * Head and tail will be used as a sentinel nodes
+ * Head and tail will be used as a sentinel nodes, their keys are never read
  * **********************************************************************/
-template <class T>
-LazyList<T>::LazyList() {
+template <class T, class Compare>
+LazyList<T, Compare>::LazyList() {
     head = new Node;
-    head->key = {};
     head->marked = false;
 
-    tail = new Node;
-    tail->key = {};
-    tail->marked = false;
-    tail->next = NULL;
+    tail = sharedTail();
 
     head->next = tail;
+    last = head;
+}
+
+/*************************************************************************
+ * Build the list from a sorted range in a single pass. Duplicate keys in
+ * the range are skipped.
+ * **********************************************************************/
+template <class T, class Compare>
+template <class InputIt>
+LazyList<T, Compare>::LazyList(InputIt first, InputIt last) : LazyList() {
+    long length = 0;
+    Node *end = head;
+    head->next = link(first, last, length, end);
+    this->last = end;
+    count.add(length);
 }
 
 /*************************************************************************
  * Deallocate linked list memory
  * **********************************************************************/
-template <class T>
-LazyList<T>::~LazyList() {
+template <class T, class Compare>
+LazyList<T, Compare>::~LazyList() {
     deleteList();
+    delete index.load();
+    delete filter.load();
 
     delete head;
-    delete tail;
 }
 
 /*************************************************************************
  * Uses Lazy Synchronization to check if the given parameter is in
  * the linked list. If found, return true, else return false.
  * **********************************************************************/
-template <class T>
-bool LazyList<T>::contains(T key) {
-    // Set curr to head node
-    Node *curr = head;
+template <class T, class Compare>
+bool LazyList<T, Compare>::contains(T key) {
+    // Definite misses are answered by the filter alone
+    CountingBloomFilter<T> *bloom = filter.load();
+    if (bloom != NULL && !bloom->mayContain(key))
+        return false;
 
-    // While not at the of the linked list
-    while (curr != tail) {
-        // If current key is >= key, break out of traversal
-        if (curr->key >= key)
-            break;
+    Probe probe(key);
+    while (true) {
+        // Set curr to the node after the closest indexed node before key,
+        // or after head
+        Node *curr = start(probe)->next;
 
-        // Set curr to next node
-        curr = curr->next;
-    }
+        // While not at the of the linked list
+        while (curr != tail) {
+            // Start loading the next node while comparing this one
+            prefetch(curr->next);
+
+            // If current key is >= key, break out of traversal
+            if (curr->key >= probe)
+                break;
+
+            // Set curr to next node
+            curr = curr->next;
+        }
+
+        // Read the mark once, so a relocation between two reads cannot
+        // make the key look absent
+        bool marked = curr->marked;
+
+        // A node relocated by compact() has a live copy, search again
+        if (marked && curr->relocated && curr->key == probe)
+            continue;
 
-    // If key is found and curr is not marked, return true
-    return (curr->key == key && !curr->marked);
+        // If key is found and curr is not marked, return true
+        return (curr != tail && curr->key == probe && !marked);
+    }
 }
 
 /*************************************************************************
@@ -100,36 +249,61 @@ bool LazyList<T>::contains(T key) {
  * return false. If parameter is not already in the linked list, add node
  * and return true.
  * **********************************************************************/
-template <class T>
-bool LazyList<T>::add(T key) {
+template <class T, class Compare>
+bool LazyList<T, Compare>::add(T key) {
+    return tryAdd(key, WAIT_FOREVER) == TryResult::SUCCEEDED;
+}
+
+/*************************************************************************
+ * Same as add(), but gives up once the given number of failed lock
+ * attempts and retries is spent, returning BUSY without having changed
+ * the list. The budget covers the whole call, so latency sensitive
+ * callers can shed or defer the update instead of queueing behind a
+ * stalled lock holder. Returns SUCCEEDED or FAILED where add()
+ * would return true or false.
+ * **********************************************************************/
+template <class T, class Compare>
+TryResult LazyList<T, Compare>::tryAdd(T key, std::size_t spins) {
+    PROFILE_LOCKS(ADD, key);
+
+    Probe probe(key);
     while (true) {
-        Node *pred = head;
-        Node *curr = head->next;
+        Node *pred = start(probe);
+        Node *curr = pred->next;
 
         // While not at the of the linked list
         while (curr != tail) {
+            // Start loading the next node while comparing this one
+            prefetch(curr->next);
+
             // If current key is >= key, break out of traversal
-            if (curr->key >= key)
+            if (curr->key >= probe)
                 break;
 
-            // Set pred to curr node
-            pred = curr;
+            // Set pred to curr node, unless removal left it marked
+            if (!curr->marked)
+                pred = curr;
 
             // Set curr to next node
             curr = curr->next;
         }
 
-        // Acquire pred and curr locks
-        pred->lock.lock();
-        curr->lock.lock();
+        // Acquire pred and curr locks, giving up if either stays busy
+        if (!acquire(pred->lock, spins))
+            return TryResult::BUSY;
+        if (!pred->marked)
+            unlinkMarked(pred);
+        if (curr != tail && !acquire(curr->lock, spins)) {
+            pred->lock.unlock();
+            return TryResult::BUSY;
+        }
 
         // Validate we locked correct nodes
         if (validate(pred, curr)) {
             // If valid & key is found in list, release locks and return false
-            if (curr != tail && curr->key == key) {
-                pred->lock.unlock();
-                curr->lock.unlock();
-                return false;
+            if (curr != tail && curr->key == probe) {
+                unlock(pred, curr);
+                return TryResult::FAILED;
             }
             // Else, add key to list, release locks and return true
             else {
@@ -137,17 +311,22 @@ bool LazyList<T>::add(T key) {
                 node->key = key;
                 node->marked = false;
                 node->next = curr;
+                filterInsert(key);
                 pred->next = node;
+                if (curr == tail)
+                    moveLast(pred, node);
 
-                pred->lock.unlock();
-                curr->lock.unlock();
+                unlock(pred, curr);
 
-                return true;
+                count.add(1);
+                refreshIndex();
+                return TryResult::SUCCEEDED;
             }
         }
-        // Validation failed, release locks and retry
-        pred->lock.unlock();
-        curr->lock.unlock();
+        // Validation failed, release locks and retry while budget remains
+        unlock(pred, curr);
+        if (!retry(spins))
+            return TryResult::BUSY;
     }
 }
 
@@ -156,36 +335,88 @@ bool LazyList<T>::add(T key) {
  * If the parameter is not found in the linked list, return false. If the
  * parameter is found in the linked list, remove it and return true.
  * **********************************************************************/
-template <class T>
-bool LazyList<T>::remove(T key) {
+template <class T, class Compare>
+bool LazyList<T, Compare>::remove(T key) {
+    return tryRemove(key, WAIT_FOREVER) == TryResult::SUCCEEDED;
+}
+
+/*************************************************************************
+ * Same as remove(), but gives up once the given number of failed lock
+ * attempts and retries is spent, returning BUSY without having changed
+ * the list. The budget covers the whole call, so latency sensitive
+ * callers can shed or defer the update instead of queueing behind a
+ * stalled lock holder. Returns SUCCEEDED or FAILED where remove()
+ * would return true or false.
+ * **********************************************************************/
+template <class T, class Compare>
+TryResult LazyList<T, Compare>::tryRemove(T key, std::size_t spins) {
+    PROFILE_LOCKS(REMOVE, key);
+
+    Probe probe(key);
     while (true) {
-        Node *pred = head;
-        Node *curr = head->next;
+        Node *pred = start(probe);
+        Node *curr = pred->next;
 
         // While not at the of the linked list
         while (curr != tail) {
+            // Start loading the next node while comparing this one
+            prefetch(curr->next);
+
             // If current key is >= key, break out of traversal
-            if (curr->key >= key)
+            if (curr->key >= probe)
                 break;
 
-            // Set pred to curr node
-            pred = curr;
+            // Set pred to curr node, unless removal left it marked
+            if (!curr->marked)
+                pred = curr;
 
             // Set curr to next node
             curr = curr->next;
         }
 
-        // Acquire pred and curr locks
-        pred->lock.lock();
-        curr->lock.lock();
+        // Deferred mode only marks the node, which needs no lock on pred
+        if (deferred.load(std::memory_order_relaxed)) {
+            if (curr == tail || curr->key != probe)
+                return TryResult::FAILED;
+            if (!acquire(curr->lock, spins))
+                return TryResult::BUSY;
+
+            if (curr->marked) {
+                curr->lock.unlock();
+                // A node relocated by compact() has a live copy, search again
+                if (!curr->relocated)
+                    return TryResult::FAILED;
+                if (!retry(spins))
+                    return TryResult::BUSY;
+                continue;
+            }
+
+            // Logical removal only, the node is unlinked later
+            curr->marked = true;
+            filterErase(key);
+            curr->lock.unlock();
+
+            count.add(-1);
+            refreshIndex();
+            return TryResult::SUCCEEDED;
+        }
+
+        // Acquire pred and curr locks, giving up if either stays busy
+        if (!acquire(pred->lock, spins))
+            return TryResult::BUSY;
+        if (!pred->marked)
+            unlinkMarked(pred);
+        if (curr != tail && !acquire(curr->lock, spins)) {
+            pred->lock.unlock();
+            return TryResult::BUSY;
+        }
 
         // Validate we locked correct nodes
         if (validate(pred, curr)) {
             // If valid & key is not found in list, release locks and return false
-            if (curr != tail && curr->key != key) {
-                pred->lock.unlock();
-                curr->lock.unlock();
-                return false;
+            if (curr == tail || curr->key != probe) {
+                unlock(pred, curr);
+                return TryResult::FAILED;
             }
             // Else, remove key from list, release locks and return true
             else {
@@ -193,28 +424,548 @@ bool LazyList<T>::remove(T key) {
 
                 // Logical removal
                 curr->marked = true;
+                filterErase(key);
 
                 // Physical removal
                 pred->next = curr->next;
+                if (pred->next == tail)
+                    moveLast(curr, pred);
 
                 // delete temp;
 
+                unlock(pred, curr);
+
+                count.add(-1);
+                refreshIndex();
+                return TryResult::SUCCEEDED;
+            }
+        }
+        // Validation failed, release locks and retry while budget remains
+        unlock(pred, curr);
+        if (!retry(spins))
+            return TryResult::BUSY;
+    }
+}
+
+/*************************************************************************
+ * Returns the number of keys in the list from per-thread striped counters
+ * updated by successful add() and remove() calls. Cheap, but updates in
+ * flight may or may not be counted. After splitAt() or concat() it is off
+ * by the moved keys until sizeExact() or reclaim() counts them.
+ * **********************************************************************/
+template <class T, class Compare>
+std::size_t LazyList<T, Compare>::size() const {
+    long length = static_cast<long>(count.approximate()) + drift.load();
+    return length > 0 ? length : 0;
+}
+
+/*************************************************************************
+ * Returns the number of keys in the list. Exact whenever no updates are
+ * in flight; under contention it retries until the counters are stable.
+ * After splitAt() or concat() the counters are off by the moved keys
+ * until the next reclaim(), so the keys are counted by walking the list.
+ * **********************************************************************/
+template <class T, class Compare>
+std::size_t LazyList<T, Compare>::sizeExact() const {
+    if (!recount.load())
+        return count.exact();
+
+    std::size_t length = walkCount();
+    drift = static_cast<long>(length) - static_cast<long>(count.approximate());
+    return length;
+}
+
+/*************************************************************************
+ * Calls fn on every key of the list, splitting the list into segments
+ * that are processed in parallel on the given number of threads. fn must
+ * be safe to call concurrently. Updates may continue during the call:
+ * keys present for the whole call are visited exactly once, keys added or
+ * removed during the call may or may not be visited, and no key is
+ * visited twice.
+ * **********************************************************************/
+template <class T, class Compare>
+template <class Function>
+void LazyList<T, Compare>::parallelForEach(std::size_t threads, Function fn) {
+    std::vector<Node *> splits = sample(threads * 4);
+
+    runSegments(threads, splits.size(), [&](std::size_t segment) {
+        forEachInSegment(splits, segment, fn);
+    });
+}
+
+/*************************************************************************
+ * Folds every key of the list into a value with reduce, processing
+ * segments in parallel as parallelForEach() does. Each segment is folded
+ * starting from identity and the per-segment results are merged in key
+ * order with combine, so combine only needs to be associative.
+ * **********************************************************************/
+template <class T, class Compare>
+template <class R, class Reduce, class Combine>
+R LazyList<T, Compare>::parallelReduce(std::size_t threads, R identity, Reduce reduce, Combine combine) {
+    std::vector<Node *> splits = sample(threads * 4);
+    std::vector<R> partial(splits.size(), identity);
+
+    runSegments(threads, splits.size(), [&](std::size_t segment) {
+        forEachInSegment(splits, segment, [&](const T &key) {
+            partial[segment] = reduce(partial[segment], key);
+        });
+    });
+
+    R result = identity;
+    for (const R &value : partial)
+        result = combine(result, value);
+    return result;
+}
+
+/*************************************************************************
+ * Replace the contents of the list with the keys of a sorted range. The
+ * new chain is linked privately in one pass, then the old keys are
+ * removed as clear() does and the new chain is published under the head
+ * lock: concurrent readers see the old keys disappear in key order and
+ * then every new key appear at once. Takes O(n) for the new keys and one
+ * lock acquisition per old node. The old chain is retired and freed by
+ * reclaim().
+ * **********************************************************************/
+template <class T, class Compare>
+template <class InputIt>
+void LazyList<T, Compare>::assign(InputIt first, InputIt last) {
+    // Linked under the lock so a filter rebuild cannot miss the new keys
+    std::lock_guard<std::mutex> compacting(compactLock);
+    long length = 0;
+    Node *end = head;
+    Node *chain = link(first, last, length, end);
+
+    std::lock_guard<NodeMutex> guard(head->lock);
+
+    // The index points into the chain about to be retired
+    {
+        std::lock_guard<std::mutex> indexing(indexLock);
+        publishIndex(NULL);
+    }
+
+    Node *old = head->next;
+    long cleared = markChain();
+    if (old != tail)
+        retired.push_back(old);
+    head->next = chain;
+    this->last = end;
+    count.add(length - cleared);
+}
+
+/*************************************************************************
+ * Remove every key from the list. Every node is marked, in key order,
+ * while head stays locked, and only then is the marked chain detached
+ * from head. An update whose key lies behind the marking front waits for
+ * the head lock, and one ahead of it either finishes before the front
+ * reaches its node, whose key the clear then removes, or fails validation
+ * and retries. A concurrent contains() sees the keys disappear one by one
+ * in key order, as if each were removed by remove(), and no key added
+ * before clear() returns survives it. Takes one lock acquisition per
+ * node; the detached chain is retired and freed by reclaim().
+ * **********************************************************************/
+template <class T, class Compare>
+void LazyList<T, Compare>::clear() {
+    std::lock_guard<std::mutex> compacting(compactLock);
+    std::lock_guard<NodeMutex> guard(head->lock);
+
+    Node *old = head->next;
+    if (old == tail)
+        return;
+
+    // The index points into the chain about to be retired
+    {
+        std::lock_guard<std::mutex> indexing(indexLock);
+        publishIndex(NULL);
+    }
+
+    count.add(-markChain());
+    retired.push_back(old);
+    head->next = tail;
+    last = head;
+}
+
+/*************************************************************************
+ * Move every node with a key not smaller than key to dst, which must be
+ * empty, without copying or allocating. The lists share their tail, so
+ * the moved chain already ends where dst needs it to, and the move only
+ * relinks the last node before key and the head of dst while holding
+ * their locks. Both are validated under those locks, so the call runs
+ * concurrently with other operations on either list. An update of a moved
+ * key already under way in the list takes effect in dst. The size of
+ * both lists is counted again lazily, see sizeExact(), and a filter on
+ * dst is dropped, see enableFilter(). Returns false if dst is not empty.
+ * **********************************************************************/
+template <class T, class Compare>
+bool LazyList<T, Compare>::splitAt(T key, LazyList &dst) {
+    if (&dst == this)
+        return false;
+
+    std::scoped_lock<std::mutex, std::mutex> compacting(compactLock, dst.compactLock);
+    std::lock_guard<NodeMutex> guard(dst.head->lock);
+
+    dst.unlinkMarked(dst.head);
+    if (dst.head->next != tail)
+        return false;
+
+    Probe probe(key);
+    Node *pred;
+    while (true) {
+        pred = start(probe);
+        for (Node *curr = pred->next; curr != tail && curr->key < probe; curr = curr->next)
+            if (!curr->marked)
+                pred = curr;
+
+        pred->lock.lock();
+        if (!pred->marked) {
+            unlinkMarked(pred);
+            // Nothing to move
+            if (pred->next == tail) {
                 pred->lock.unlock();
-                curr->lock.unlock();
                 return true;
             }
+            // Nothing can be linked after pred while it is locked
+            if (!(pred->next->key < probe))
+                break;
         }
-        // Validation failed, release locks and retry
+        pred->lock.unlock();
+    }
+    Node *first = pred->next;
+
+    // Drop index entries that are about to move
+    {
+        std::lock_guard<std::mutex> indexing(indexLock);
+
+        Index *curr = index.load();
+        if (curr != NULL) {
+            Index *fresh = new Index;
+            fresh->built = curr->built;
+            for (Node *node : curr->entries)
+                if (node->key < probe)
+                    fresh->entries.push_back(node);
+            publishIndex(fresh);
+        }
+    }
+
+    // Keep the end of the list if it moves along
+    Node *end = last.load();
+    dst.last = end != head && !(end->key < probe) ? end : dst.head;
+
+    dst.dropFilter();
+    dst.head->next = first;
+    pred->next = tail;
+    last = pred;
+    pred->lock.unlock();
+
+    recount = true;
+    dst.recount = true;
+
+    // Moved nodes may live in compaction chunks
+    shareChunks(dst);
+    return true;
+}
+
+/*************************************************************************
+ * Move every node of other to the end of the list, without copying or
+ * allocating. All keys of other must be greater than every key in the
+ * list. The lists share their tail, so the move only relinks the last
+ * node of the list and the head of other while holding their locks. The
+ * key ranges are checked under those locks, so the call runs
+ * concurrently with other operations on either list. An update of a moved
+ * key already under way in other takes effect in the list. The size of
+ * both lists is counted again lazily, see sizeExact(), and a filter on
+ * the list is dropped, see enableFilter(). Returns false if the key
+ * ranges overlap.
+ * **********************************************************************/
+template <class T, class Compare>
+bool LazyList<T, Compare>::concat(LazyList &other) {
+    if (&other == this)
+        return false;
+
+    std::scoped_lock<std::mutex, std::mutex> compacting(compactLock, other.compactLock);
+    std::lock_guard<NodeMutex> guard(other.head->lock);
+
+    other.unlinkMarked(other.head);
+    Node *first = other.head->next;
+    if (first == tail)
+        return true;
+
+    Node *end = lockLast();
+    if (end != head && !(end->key < first->key)) {
+        end->lock.unlock();
+        return false;
+    }
+
+    // The index of other points at the moved nodes
+    {
+        std::lock_guard<std::mutex> indexing(other.indexLock);
+        other.publishIndex(NULL);
+    }
+
+    Node *moved = other.last.load();
+
+    dropFilter();
+    end->next = first;
+    other.head->next = tail;
+    last = moved != other.head ? moved : end;
+    other.last = other.head;
+    end->lock.unlock();
+
+    recount = true;
+    other.recount = true;
+
+    // Moved nodes may live in compaction chunks
+    other.shareChunks(*this);
+    return true;
+}
+
+/*************************************************************************
+ * In deferred mode remove() only marks the node, holding just its own
+ * lock, and leaves it linked. Marked nodes are unlinked in batches by the
+ * next add() or remove() that locks the node before them, or by sweep().
+ * contains() already treats marked nodes as absent.
+ * **********************************************************************/
+template <class T, class Compare>
+void LazyList<T, Compare>::setDeferredUnlink(bool enabled) {
+    deferred.store(enabled);
+}
+
+/*************************************************************************
+ * Unlink every node left marked by deferred removal and return how many
+ * were unlinked. Runs concurrently with other operations, locking one
+ * node at a time, so it can be called from a background thread.
+ * **********************************************************************/
+template <class T, class Compare>
+std::size_t LazyList<T, Compare>::sweep() {
+    std::size_t unlinked = 0;
+    Node *pred = head;
+
+    while (pred != tail) {
+        pred->lock.lock();
+        // A marked pred is unlinked itself by the sweep of its own pred
+        if (!pred->marked)
+            unlinked += unlinkMarked(pred);
+        Node *next = pred->next;
+        pred->lock.unlock();
+        pred = next;
+    }
+    return unlinked;
+}
+
+/*************************************************************************
+ * Moves the nodes of the list, in key order, into contiguous chunks so
+ * later traversals walk memory mostly sequentially. Runs concurrently with
+ * other operations: nodes are copied hand-over-hand while holding the
+ * locks of pred and curr, the copy is linked in place of curr, and curr is
+ * marked as relocated so operations holding it retry. curr is left
+ * pointing at its copy, so a traversal standing on it carries on through
+ * the live copy instead of skipping the key. Nodes that already
+ * directly follow their predecessor in memory are left in place, so
+ * compacting an already compact list only walks it. Old copies are freed
+ * by reclaim(). Only one compaction runs at a time.
+ * **********************************************************************/
+template <class T, class Compare>
+void LazyList<T, Compare>::compact() {
+    std::unique_lock<std::mutex> guard(compactLock, std::try_to_lock);
+    if (!guard.owns_lock())
+        return;
+
+    Node *chunk = NULL;
+    std::size_t used = CHUNK;
+
+    Node *pred = head;
+    pred->lock.lock();
+
+    while (pred->next != tail) {
+        Node *curr = pred->next;
+        curr->lock.lock();
+
+        // Drop nodes removed in deferred mode instead of copying them
+        if (curr->marked) {
+            pred->next = curr->next;
+            moveLast(curr, pred);
+            curr->lock.unlock();
+            continue;
+        }
+
+        // Leave nodes that already follow pred in memory
+        if (reinterpret_cast<char *>(curr) == reinterpret_cast<char *>(pred) + sizeof(Node)) {
+            pred->lock.unlock();
+            pred = curr;
+            continue;
+        }
+
+        if (used == CHUNK) {
+            chunk = new Node[CHUNK];
+            chunks->push_back(std::unique_ptr<Node[]>(chunk));
+            used = 0;
+        }
+
+        // Copy curr into the chunk and link the copy in its place
+        Node *node = &chunk[used++];
+        node->key = curr->key.get();
+        node->marked = false;
+        node->pooled = true;
+        node->next = curr->next;
+        node->lock.lock();
+
+        // Point curr at the copy before marking it, so a walker that sees
+        // the mark moves on to the copy
+        curr->relocated = true;
+        curr->next = node;
+        curr->marked = true;
+        pred->next = node;
+        moveLast(curr, node);
+        relocated.push_back(curr);
+
         pred->lock.unlock();
         curr->lock.unlock();
+        pred = node;
+    }
+    pred->lock.unlock();
+
+    // Every indexed node has been relocated
+    rebuildIndex();
+}
+
+/*************************************************************************
+ * Enables the shortcut index over every stride-th node, or disables it
+ * when stride is 0. With the index enabled, contains(), add() and
+ * remove() binary-search it for the closest unmarked node before the key
+ * and start traversing there instead of at head. The index is rebuilt
+ * when the list size drifts to half or double the size it was built at,
+ * or when it has gone stale, see refreshIndex().
+ * **********************************************************************/
+template <class T, class Compare>
+void LazyList<T, Compare>::enableIndex(std::size_t stride) {
+    std::lock_guard<std::mutex> guard(indexLock);
+
+    indexStride = stride;
+    buildIndex();
+}
+
+/*************************************************************************
+ * Rebuilds the shortcut index from a fresh walk of the list. May run
+ * concurrently with other operations, e.g. from a background thread.
+ * **********************************************************************/
+template <class T, class Compare>
+void LazyList<T, Compare>::rebuildIndex() {
+    std::lock_guard<std::mutex> guard(indexLock);
+
+    buildIndex();
+}
+
+/*************************************************************************
+ * Enables a counting Bloom filter with the given number of counters, or
+ * disables it when size is 0. While enabled, contains() answers keys the
+ * filter rules out without touching the list; add() and remove() keep it
+ * up to date, so removals do not leave it stale. Calling it again with a
+ * new size rebuilds the filter from the current keys, which clears
+ * counters saturated by heavy churn. The filter hashes keys with
+ * std::hash, so keys equal under Compare must hash alike.
+ *
+ * Rebuilding is safe while other threads use the list. The new filter is
+ * published as filling first, so add() records keys in both filters, and
+ * the rebuild then walks the list taking each node's lock. An add()
+ * either links its node before the walk reaches its pred, and the walk
+ * counts it, or locks pred after the walk has passed it and so sees the
+ * new filter; a remove() erases under the node's lock, from the filter in
+ * use at that time, which already counts the key. The new filter can
+ * therefore only count a key too often, a false positive, and never miss
+ * one. The old filter may still be read and is freed by reclaim().
+ * **********************************************************************/
+template <class T, class Compare>
+void LazyList<T, Compare>::enableFilter(std::size_t size) {
+    // Compaction would move keys behind the walk
+    std::lock_guard<std::mutex> compacting(compactLock);
+    CountingBloomFilter<T> *fresh = NULL;
+
+    if (size > 0) {
+        fresh = new CountingBloomFilter<T>(size);
+        filling.store(fresh);
+
+        for (Node *curr = head; curr != tail;) {
+            curr->lock.lock();
+            if (curr != head && !curr->marked)
+                fresh->insert(curr->key);
+            Node *succ = curr->next;
+            curr->lock.unlock();
+            curr = succ;
+        }
+    }
+
+    CountingBloomFilter<T> *old = filter.exchange(fresh);
+    filling.store(NULL);
+    if (old != NULL)
+        retiredFilters.push_back(old);
+}
+
+/*************************************************************************
+ * Copy the keys into an immutable FrozenSet for read-only phases. Updates
+ * racing with the copy may or may not be included.
+ * **********************************************************************/
+template <class T, class Compare>
+FrozenSet<T, Compare> LazyList<T, Compare>::freeze(typename FrozenSet<T, Compare>::Layout layout) {
+    std::vector<T> keys;
+    keys.reserve(size());
+    for (Node *curr = head->next; curr != tail; curr = curr->next)
+        if (!curr->marked)
+            keys.push_back(curr->key);
+    return FrozenSet<T, Compare>(std::move(keys), layout);
+}
+
+/*************************************************************************
+ * Free chains retired by clear() and assign(), nodes relocated by
+ * compact() and filters replaced by enableFilter(). Counts the keys
+ * again after splitAt() or concat(). The caller must ensure no other
+ * thread is still operating on the list.
+ * **********************************************************************/
+template <class T, class Compare>
+void LazyList<T, Compare>::reclaim() {
+    {
+        std::lock_guard<NodeMutex> guard(head->lock);
+
+        for (Node *chain : retired)
+            freeChain(chain);
+        retired.clear();
     }
+    {
+        std::lock_guard<std::mutex> guard(compactLock);
+
+        for (Node *node : relocated)
+            if (!node->pooled)
+                delete node;
+        relocated.clear();
+
+        for (CountingBloomFilter<T> *old : retiredFilters)
+            delete old;
+        retiredFilters.clear();
+
+        // The hint may point at a node freed above
+        Node *end = head;
+        for (Node *curr = head->next; curr != tail; curr = curr->next)
+            end = curr;
+        last = end;
+
+        if (recount.load()) {
+            count.reset();
+            count.add(walkCount());
+            drift = 0;
+            recount = false;
+        }
+    }
+
+    std::lock_guard<std::mutex> guard(indexLock);
+
+    // Make sure the index does not point at any node freed above
+    buildIndex();
+
 }
 
 /*************************************************************************
  * Display contents of linked list
  * **********************************************************************/
-template <class T>
-void LazyList<T>::printList() {
+template <class T, class Compare>
+void LazyList<T, Compare>::printList() {
     // Acquire head lock
     head->lock.lock();
 
@@ -235,32 +986,455 @@ void LazyList<T>::printList() {
  * Validation checks that neither the pred nor curr nodes have been logically
  * deleted, and that pred points to curr.
  * **********************************************************************/
-template <class T>
-bool LazyList<T>::validate(Node *pred, Node *curr) {
+template <class T, class Compare>
+bool LazyList<T, Compare>::validate(Node *pred, Node *curr) {
     return (!pred->marked && !curr->marked && pred->next == curr);
 }
 
 /*************************************************************************
- * Delete contents of linked list
+ * Unlink the run of marked nodes directly after pred, which must be
+ * locked and unmarked, and return its length. The next field of a marked
+ * node never changes again, since every update validates that its pred is
+ * unmarked, so the run can be skipped without locking its nodes.
+ * **********************************************************************/
+template <class T, class Compare>
+std::size_t LazyList<T, Compare>::unlinkMarked(Node *pred) {
+    std::size_t unlinked = 0;
+    Node *succ = pred->next;
+
+    while (succ != tail && succ->marked) {
+        succ = succ->next;
+        unlinked++;
+    }
+    if (unlinked > 0)
+        pred->next = succ;
+    return unlinked;
+}
+
+/*************************************************************************
+ * The tail sentinel shared by every list of this type. It is never
+ * locked, marked or freed, and its key is never read.
+ * **********************************************************************/
+template <class T, class Compare>
+typename LazyList<T, Compare>::Node *LazyList<T, Compare>::sharedTail() {
+    static Node *sentinel = [] {
+        Node *node = new Node;
+        node->marked = false;
+        node->next = NULL;
+        return node;
+    }();
+    return sentinel;
+}
+
+/*************************************************************************
+ * Release the locks taken by an update on pred and curr. The shared tail
+ * is never locked, since lists moving chains between them would contend
+ * on it.
+ * **********************************************************************/
+template <class T, class Compare>
+void LazyList<T, Compare>::unlock(Node *pred, Node *curr) {
+    pred->lock.unlock();
+    if (curr != tail)
+        curr->lock.unlock();
+}
+
+/*************************************************************************
+ * Lock and return the last unmarked node of the list, or head when the
+ * list is empty. Tries the last hint first and walks the list only when
+ * an update raced with the hint and left it stale.
+ * **********************************************************************/
+template <class T, class Compare>
+typename LazyList<T, Compare>::Node *LazyList<T, Compare>::lockLast() {
+    Node *pred = last.load();
+
+    while (true) {
+        pred->lock.lock();
+        if (!pred->marked) {
+            unlinkMarked(pred);
+            if (pred->next == tail) {
+                last = pred;
+                return pred;
+            }
+        }
+        pred->lock.unlock();
+
+        pred = head;
+        for (Node *curr = head->next; curr != tail; curr = curr->next)
+            if (!curr->marked)
+                pred = curr;
+    }
+}
+
+/*************************************************************************
+ * Move the last hint from one node to another, unless an update has
+ * already moved it elsewhere
+ * **********************************************************************/
+template <class T, class Compare>
+void LazyList<T, Compare>::moveLast(Node *from, Node *to) {
+    last.compare_exchange_strong(from, to);
+}
+
+/*************************************************************************
+ * Count the unmarked nodes of the list. Updates racing with the walk may
+ * or may not be counted.
+ * **********************************************************************/
+template <class T, class Compare>
+std::size_t LazyList<T, Compare>::walkCount() const {
+    std::size_t length = 0;
+    for (Node *curr = head->next; curr != tail; curr = curr->next)
+        if (!curr->marked)
+            length++;
+    return length;
+}
+
+/*************************************************************************
+ * Disable the filter once keys it never saw were moved into the list.
+ * The old filter may still be read and is freed by reclaim(). The caller
+ * must hold compactLock.
+ * **********************************************************************/
+template <class T, class Compare>
+void LazyList<T, Compare>::dropFilter() {
+    CountingBloomFilter<T> *old = filter.exchange(NULL);
+    if (old != NULL)
+        retiredFilters.push_back(old);
+}
+
+/*************************************************************************
+ * Mark every node of the list, locking one node at a time, and return how
+ * many were unmarked. The caller holds the head lock, so no node can be
+ * linked behind the marking front: its pred would be head or a marked
+ * node. A marked node's next never changes again, so the walk reaches
+ * every node linked ahead of the front and none is left unmarked.
+ * **********************************************************************/
+template <class T, class Compare>
+long LazyList<T, Compare>::markChain() {
+    long cleared = 0;
+
+    for (Node *curr = head->next; curr != tail;) {
+        std::lock_guard<NodeMutex> guard(curr->lock);
+        if (!curr->marked) {
+            curr->marked = true;
+            filterErase(curr->key);
+            cleared++;
+        }
+        curr = curr->next;
+    }
+    return cleared;
+}
+
+/*************************************************************************
+ * Returns the node to start a traversal for key from: the last indexed
+ * node with a smaller key that is still unmarked, and so still reachable,
+ * or head if there is none.
+ * **********************************************************************/
+template <class T, class Compare>
+typename LazyList<T, Compare>::Node *LazyList<T, Compare>::start(const Probe &probe) {
+    if (index.load(std::memory_order_relaxed) == NULL)
+        return head;
+
+    unsigned side = enterIndex();
+    Index *curr = index.load(std::memory_order_acquire);
+    if (curr == NULL) {
+        leaveIndex(side);
+        return head;
+    }
+
+    // Binary search for the first entry not smaller than key
+    std::size_t low = 0;
+    std::size_t high = curr->entries.size();
+    while (low < high) {
+        std::size_t mid = (low + high) / 2;
+        if (curr->entries[mid]->key < probe)
+            low = mid + 1;
+        else
+            high = mid;
+    }
+
+    // Step back over entries removed since the index was built
+    std::size_t stepped = 0;
+    Node *node = head;
+    while (low > 0) {
+        Node *entry = curr->entries[--low];
+        if (!entry->marked) {
+            node = entry;
+            break;
+        }
+        stepped++;
+    }
+
+    if (stepped != 0)
+        curr->skipped.fetch_add(stepped, std::memory_order_relaxed);
+    leaveIndex(side);
+    return node;
+}
+
+/*************************************************************************
+ * Called after successful updates. Every 256 updates on a thread, rebuilds
+ * the index if the list has shrunk to half or grown to double the size it
+ * was built at, or if it has gone stale: as many updates as the list held
+ * keys have been made since the rebuild, or lookups have stepped over as
+ * many removed entries, so the walk of a rebuild has been paid for.
+ * Skipped if another thread is already rebuilding.
+ * **********************************************************************/
+template <class T, class Compare>
+void LazyList<T, Compare>::refreshIndex() {
+    thread_local std::size_t updates = 0;
+
+    if (indexStride == 0 || ++updates % 256 != 0)
+        return;
+
+    // Stop reading the index before rebuilding, which waits for readers
+    unsigned side = enterIndex();
+    Index *curr = index.load(std::memory_order_acquire);
+    std::size_t built = curr != NULL ? curr->built : 0;
+    std::size_t now = size();
+    bool resized = now > 2 * built + indexStride || 2 * now + indexStride < built;
+    bool stale = curr != NULL && (curr->updates.fetch_add(256, std::memory_order_relaxed) + 256 >= built + indexStride ||
+                                  curr->skipped.load(std::memory_order_relaxed) >= built + indexStride);
+    leaveIndex(side);
+    if (!resized && !stale)
+        return;
+
+    std::unique_lock<std::mutex> guard(indexLock, std::try_to_lock);
+    if (guard.owns_lock())
+        buildIndex();
+}
+
+/*************************************************************************
+ * Walks the list and publishes an index over every stride-th unmarked
+ * node, or no index if it is disabled. Called with indexLock held.
+ * **********************************************************************/
+template <class T, class Compare>
+void LazyList<T, Compare>::buildIndex() {
+    if (indexStride == 0) {
+        publishIndex(NULL);
+        return;
+    }
+
+    Index *fresh = new Index;
+    fresh->built = 0;
+    for (Node *curr = head->next; curr != tail; curr = curr->next) {
+        if (curr->marked)
+            continue;
+        if (fresh->built++ % indexStride == 0)
+            fresh->entries.push_back(curr);
+    }
+    publishIndex(fresh);
+}
+
+/*************************************************************************
+ * Installs a new index and frees the old one once no thread is reading
+ * it. Readers are counted on the side they entered on; flipping the side
+ * after the swap leaves only readers of the old side that may still hold
+ * the old index, and each holds it for one binary search, so the wait is
+ * short. Called with indexLock held.
+ * **********************************************************************/
+template <class T, class Compare>
+void LazyList<T, Compare>::publishIndex(Index *fresh) {
+    Index *old = index.exchange(fresh);
+    if (old == NULL)
+        return;
+
+    unsigned side = indexSide.load();
+    indexSide.store(side ^ 1);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+
+    // Every thread updates one stripe, so a zero sum means no reader
+    while (indexReaders[side].approximate() != 0)
+        std::this_thread::yield();
+    std::atomic_thread_fence(std::memory_order_acquire);
+    delete old;
+}
+
+/*************************************************************************
+ * Counts the calling thread as a reader of the index until leaveIndex().
+ * A reader that entered on a side flipped meanwhile enters again, so no
+ * reader of the old side loads the index after publishIndex() swapped it.
+ * **********************************************************************/
+template <class T, class Compare>
+unsigned LazyList<T, Compare>::enterIndex() {
+    while (true) {
+        unsigned side = indexSide.load();
+        indexReaders[side].add(1);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (indexSide.load() == side)
+            return side;
+        indexReaders[side].add(-1);
+    }
+}
+
+template <class T, class Compare>
+void LazyList<T, Compare>::leaveIndex(unsigned side) {
+    std::atomic_thread_fence(std::memory_order_release);
+    indexReaders[side].add(-1);
+}
+
+/*************************************************************************
+ * Record a key in the filter, if enabled, and in the one being built, if
+ * any, before it becomes visible
  * **********************************************************************/
-template <class T>
-void LazyList<T>::deleteList() {
+template <class T, class Compare>
+void LazyList<T, Compare>::filterInsert(const T &key) {
+    CountingBloomFilter<T> *next = filling.load();
+    CountingBloomFilter<T> *bloom = filter.load();
+    if (bloom != NULL)
+        bloom->insert(key);
+    if (next != NULL && next != bloom)
+        next->insert(key);
+}
+
+/*************************************************************************
+ * Drop a key from the filter, if enabled, once it is no longer visible
+ * **********************************************************************/
+template <class T, class Compare>
+void LazyList<T, Compare>::filterErase(const T &key) {
+    CountingBloomFilter<T> *bloom = filter.load();
+    if (bloom != NULL)
+        bloom->erase(key);
+}
+
+/*************************************************************************
+ * Link the keys of a sorted range into a private chain ending at tail and
+ * return its first node. The number of nodes linked is added to length
+ * and end is set to the last node, if any.
+ * **********************************************************************/
+template <class T, class Compare>
+template <class InputIt>
+typename LazyList<T, Compare>::Node *LazyList<T, Compare>::link(InputIt first, InputIt last, long &length, Node *&end) {
+    Node *chain = tail;
+    Node **next = &chain;
+
+    for (Node *prev = NULL; first != last; ++first) {
+        // Skip duplicate keys
+        if (prev != NULL && prev->key == *first)
+            continue;
+
+        Node *node = new Node;
+        node->key = *first;
+        filterInsert(*first);
+        node->marked = false;
+        node->next = tail;
+
+        *next = node;
+        next = &node->next;
+        prev = node;
+        end = node;
+        length++;
+    }
+    return chain;
+}
+
+/*************************************************************************
+ * Picks up to the given number of unmarked nodes, evenly spaced, as the
+ * first nodes of the segments. Uses the shortcut index when it has enough
+ * entries, otherwise walks the list once spacing them according to size().
+ * Returns no nodes for an empty list.
+ * **********************************************************************/
+template <class T, class Compare>
+std::vector<typename LazyList<T, Compare>::Node *> LazyList<T, Compare>::sample(std::size_t segments) {
+    std::vector<Node *> splits;
+    std::size_t stride = size() / (segments ? segments : 1) + 1;
+    std::size_t i = 0;
+
+    // Pick the split points from the shortcut index instead of walking
+    unsigned side = enterIndex();
+    Index *curr = index.load(std::memory_order_acquire);
+    if (curr != NULL && curr->entries.size() >= segments) {
+        Node *first = head->next;
+        while (first != tail && first->marked)
+            first = first->next;
+
+        if (first != tail) {
+            splits.push_back(first);
+            for (std::size_t j = 1; j < segments; j++) {
+                Node *node = curr->entries[j * curr->entries.size() / segments];
+                if (!node->marked && splits.back()->key < node->key.get())
+                    splits.push_back(node);
+            }
+        }
+        leaveIndex(side);
+        return splits;
+    }
+    leaveIndex(side);
+
+    for (Node *curr = head->next; curr != tail; curr = curr->next) {
+        if (curr->marked)
+            continue;
+        if (i++ % stride == 0)
+            splits.push_back(curr);
+    }
+    return splits;
+}
+
+/*************************************************************************
+ * Calls fn on every unmarked node from the first node of the segment up
+ * to the first key of the next segment. Ending on a key rather than a
+ * node keeps the segments disjoint even if the next split node is removed.
+ * A node relocated by compact() leads on to its live copy, so the walk
+ * neither misses the key nor, having visited the old node, repeats it.
+ * **********************************************************************/
+template <class T, class Compare>
+template <class Function>
+void LazyList<T, Compare>::forEachInSegment(const std::vector<Node *> &splits, std::size_t segment, Function fn) {
+    Node *curr = splits[segment];
+    Node *next = segment + 1 < splits.size() ? splits[segment + 1] : tail;
+
+    Node *visited = NULL;
+
+    while (curr != tail && (next == tail || curr->key < next->key)) {
+        // A node relocated after it was visited leads on to its copy
+        if (!curr->marked && (visited == NULL || visited->key < curr->key)) {
+            fn(curr->key);
+            visited = curr;
+        }
+        curr = curr->next;
+    }
+}
+
+/*************************************************************************
+ * Free every node of a chain up to the tail sentinel
+ * **********************************************************************/
+template <class T, class Compare>
+void LazyList<T, Compare>::freeChain(Node *curr) {
     Node *temp;
 
-    while (head->next != tail) {
-        temp = head->next;
-        head->next = temp->next;
-        delete temp;
+    while (curr != tail) {
+        temp = curr;
+        curr = curr->next;
+        if (!temp->pooled)
+            delete temp;
     }
+}
 
-    head = new Node;
-    head->key = {};
-    head->marked = false;
+/*************************************************************************
+ * Keep the chunks nodes of the list may live in alive for as long as dst
+ * is, after nodes were moved to dst. Each set of chunks is shared once,
+ * so moving nodes back and forth does not grow the list of them.
+ * **********************************************************************/
+template <class T, class Compare>
+void LazyList<T, Compare>::shareChunks(LazyList &dst) {
+    auto share = [&dst](const std::shared_ptr<Chunks> &arena) {
+        if (arena != dst.chunks && std::find(dst.borrowed.begin(), dst.borrowed.end(), arena) == dst.borrowed.end())
+            dst.borrowed.push_back(arena);
+    };
 
-    tail = new Node;
-    tail->key = {};
-    tail->marked = false;
-    tail->next = NULL;
+    share(chunks);
+    for (const std::shared_ptr<Chunks> &arena : borrowed)
+        share(arena);
+}
 
+/*************************************************************************
+ * Delete contents of linked list
+ * **********************************************************************/
+template <class T, class Compare>
+void LazyList<T, Compare>::deleteList() {
+    freeChain(head->next);
     head->next = tail;
+    last = head;
+    count.reset();
+
+    reclaim();
+
+    chunks = std::make_shared<Chunks>();
+    borrowed.clear();
 }
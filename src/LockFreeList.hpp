@@ -3,39 +3,122 @@
  *
  * Lock-free Linked List
  *
+ * Keys are kept in the order given by Compare. The head and tail
+ * sentinels hold no key: traversals start after head and recognize tail
+ * by its address, so every value of the key type can be stored.
+ *
+ * Traversals prefetch the next node, but unlike LazyList the nodes are
+ * never compacted: without node locks a key cannot move to a new node
+ * without briefly vanishing from contains().
+ *
  * **********************************************************************/
 #pragma once
 
-#include <climits>
+#include <functional>
 #include <iostream>
+#include <mutex>
+#include <random>
+#include <thread>
+#include <vector>
 
 #include "AtomicMarkableReference.hpp"
+#include "BloomFilter.hpp"
+#include "FrozenSet.hpp"
+#include "NodeKey.hpp"
+#include "ParallelSegments.hpp"
+#include "Prefetch.hpp"
+#include "StripedCounter.hpp"
 
-template <class T>
+template <class T, class Compare = std::less<T>>
 class LockFreeList {
    public:
     LockFreeList();
+    template <class InputIt>
+    LockFreeList(InputIt, InputIt);
     ~LockFreeList();
     bool contains(T);
     bool add(T);
     bool remove(T);
+    bool replace(T, T);
+    bool popMin(T &);
+    bool popMinRelaxed(T &, std::size_t);
+    bool peekMin(T &);
+    std::size_t size() const;
+    std::size_t sizeExact() const;
+    template <class Function>
+    void parallelForEach(std::size_t, Function);
+    template <class R, class Reduce, class Combine>
+    R parallelReduce(std::size_t, R, Reduce, Combine);
+    template <class InputIt>
+    void assign(InputIt, InputIt);
+    void clear();
+    void enableFilter(std::size_t);
+    FrozenSet<T, Compare> freeze(typename FrozenSet<T, Compare>::Layout = FrozenSet<T, Compare>::SORTED);
+    void reclaim();
     void printList();
     void deleteList();
 
    private:
+    typedef typename NodeKey<T, Compare>::Probe Probe;
+
+    /*
+     * Descriptor of a replace() in progress. The status is the single point
+     * at which the old key disappears and the new key appears.
+     */
+    struct Replace {
+        enum Status { UNDECIDED, SUCCEEDED, FAILED };
+        std::atomic<int> status;
+        std::atomic<bool> linked;
+        // Next on the retired stack once no node refers to it
+        Replace *retiredNext;
+        Replace() : status(UNDECIDED), linked(false), retiredNext(NULL) {}
+    };
+
     struct Node {
-        T key;
+        NodeKey<T, Compare> key;
         AtomicMarkableReference<Node> *next;
+        std::atomic<Replace *> pending;
+        // Epoch of the newest filter known to count the key, see
+        // enableFilter()
+        std::atomic<unsigned long> filtered;
         Node() {
-            key = {};
+            key = T();
             next = new AtomicMarkableReference<Node>;
+            pending = NULL;
+            filtered = 0;
         }
         Node(T myKey) {
             key = myKey;
             next = new AtomicMarkableReference<Node>;
+            pending = NULL;
+            filtered = 0;
+        }
+        ~Node() {
+            delete next;
+        }
+    };
+
+    /*
+     * A chain detached by clear() or assign(), kept on a lock-free stack
+     * until reclaim() frees it.
+     */
+    struct Retired {
+        Node *chain;
+        Retired *next;
+        Retired(Node *myChain, Retired *myNext) {
+            chain = myChain;
+            next = myNext;
         }
     };
 
+    /*
+     * A Bloom filter and the epoch at which enableFilter() published it
+     */
+    struct Filter : CountingBloomFilter<T> {
+        unsigned long epoch;
+        Filter(std::size_t size, unsigned long myEpoch) : CountingBloomFilter<T>(size), epoch(myEpoch) {}
+    };
+
     struct Window {
         Node *pred;
         Node *curr;
@@ -46,15 +129,18 @@ class LockFreeList {
 
         /*
          * Creates a structure containing the nodes on either side of
-         * the key. It removes marked nodes when it encounters them.
+         * the key. It removes marked nodes when it encounters them, and
+         * settles any replace() still undecided on a node holding the key.
+         * curr is tail when every key in the list is less than key.
          */
-        Window(Node *head, int key) {
+        Window(Node *head, Node *tail, const T &key) {
             pred = NULL;
             curr = NULL;
             Node *succ = NULL;
 
             bool *marked = new bool;
             bool snip;
+            Probe probe(key);
 
         RETRY:
             while (true) {
@@ -62,6 +148,9 @@ class LockFreeList {
                 curr = pred->next->getReference();
                 while (true) {
                     succ = curr->next->get(marked);
+                    // Start loading the next node while handling this one
+                    if (succ != tail)
+                        prefetch(succ);
                     while (marked[0]) {
                         snip = pred->next->CAS(curr, succ, false, false);
                         if (!snip)
@@ -69,7 +158,9 @@ class LockFreeList {
                         curr = succ;
                         succ = curr->next->get(marked);
                     }
-                    if (curr->key >= key) {
+                    if (curr == tail || curr->key >= probe) {
+                        if (curr != tail && curr->key == probe && settle(curr))
+                            goto RETRY;
                         Window(pred, curr);
                         return;
                     }
@@ -81,29 +172,75 @@ class LockFreeList {
     };
     Node *head;
     Node *tail;
+    std::atomic<Retired *> retired;
+    std::atomic<Replace *> retiredReplaces{NULL};
+    StripedCounter count;
+    std::atomic<Filter *> filter{NULL};
+    // Filter being built by enableFilter(), which updates fill as well
+    std::atomic<Filter *> filling{NULL};
+    std::atomic<unsigned long> filterEpoch{0};
+    // Updates between recording a key and linking its node, counted by the
+    // parity of the epoch they entered in, see enterFilter()
+    StripedCounter filterWriters[2];
+    std::vector<Filter *> retiredFilters;
+    std::mutex filterLock;
+    template <class InputIt>
+    Node *link(InputIt, InputIt, long &);
+    void retire(Node *);
+    void retire(Replace *);
+    void freeChain(Node *);
+    std::vector<Node *> sample(std::size_t);
+    template <class Function>
+    void forEachInSegment(const std::vector<Node *> &, std::size_t, Function);
+    static int decide(Replace *);
+    static bool present(Node *);
+    static bool settle(Node *);
+    static bool markNode(Node *);
+    Node *poisonHead();
+    long markChain(Node *);
+    bool removeNode(Node *, Node *, T &);
+    unsigned enterFilter();
+    void leaveFilter(unsigned);
+    void filterInsert(Node *);
+    void filterLinked(Node *);
+    void filterErase(Node *);
+    static void stamp(Node *, unsigned long);
 };
 
 /*
  * Initialize class variables
- * Head and tail will be used as a sentinel nodes
+ * Head and tail will be used as a sentinel nodes, their keys are never read
  */
-template <class T>
-LockFreeList<T>::LockFreeList() {
-    head = new Node(INT_MIN);
+template <class T, class Compare>
+LockFreeList<T, Compare>::LockFreeList() : retired(NULL) {
+    head = new Node();
 
-    tail = new Node(INT_MAX);
+    tail = new Node();
 
     /* Set next of head to tail
      * and next of tail will be NULL, false due to default constructors */
     head->next->set(tail, false);
 }
 
+/*
+ * Build the list from a sorted range in a single pass. Duplicate keys in
+ * the range are skipped.
+ */
+template <class T, class Compare>
+template <class InputIt>
+LockFreeList<T, Compare>::LockFreeList(InputIt first, InputIt last) : LockFreeList() {
+    long length = 0;
+    head->next->set(link(first, last, length), false);
+    count.add(length);
+}
+
 /*
  * Deallocate linked list memory
  */
-template <class T>
-LockFreeList<T>::~LockFreeList() {
+template <class T, class Compare>
+LockFreeList<T, Compare>::~LockFreeList() {
     deleteList();
+    delete filter.load();
 
     delete head;
     delete tail;
@@ -113,105 +250,828 @@ LockFreeList<T>::~LockFreeList() {
  * This wait-free contains method is almost the same as the Lazy
  * Synchronization method. It checks if the given parameter is in the linked
  * list. If found, return true, else return false. The only small differance
- * is it calls curr->next->get(marked) to test whether curr is marked.
+ * is it calls curr->next->get(marked) to test whether curr is marked, and
+ * that a node taking part in a replace() is only counted once the replace
+ * has decided in its favour.
  */
-template <class T>
-bool LockFreeList<T>::contains(T key) {
-    bool *marked = new bool;
+template <class T, class Compare>
+bool LockFreeList<T, Compare>::contains(T key) {
+    // Definite misses are answered by the filter alone
+    Filter *bloom = filter.load();
+    if (bloom != NULL && !bloom->mayContain(key))
+        return false;
 
-    Node *curr = head;
-    while (curr->key < key) {
+    Probe probe(key);
+    Node *curr = head->next->getReference();
+    while (curr != tail) {
+        // Start loading the next node while comparing this one
+        prefetch(curr->next->getReference());
+        if (curr->key >= probe)
+            break;
         curr = curr->next->getReference();
-        curr->next->get(marked);
     }
 
-    return (curr->key == key && !marked[0]);
+    // A replaced node may still be linked next to its successor
+    while (curr != tail && curr->key == probe) {
+        if (present(curr))
+            return true;
+        curr = curr->next->getReference();
+    }
+    return false;
 }
 
 /*
  * The add method creates a window to locate pred and curr. It adds a new
  * node only if pred is unmarked and refers to curr.
  */
-template <class T>
-bool LockFreeList<T>::add(T key) {
+template <class T, class Compare>
+bool LockFreeList<T, Compare>::add(T key) {
     while (true) {
-        Window window(head, key);
+        Window window(head, tail, key);
         Node *pred = window.pred;
         Node *curr = window.curr;
-        if (curr->key == key) {
+        if (curr != tail && curr->key == key) {
             return false;
         } else {
             Node *node = new Node(key);
             node->next->set(curr, false);
+            unsigned side = enterFilter();
+            filterInsert(node);
             if (pred->next->CAS(curr, node, false, false)) {
+                filterLinked(node);
+                leaveFilter(side);
+                count.add(1);
                 return true;
             }
+            filterErase(node);
+            leaveFilter(side);
+            delete node;
         }
     }
 }
 
 /*
  * The remove method creates a window to locate pred and curr, and atomically
- * marks the node for removal.
+ * marks the node for removal. The mark fails while a replace() has the
+ * node reserved; the retried window settles that replace first.
  */
-template <class T>
-bool LockFreeList<T>::remove(T key) {
+template <class T, class Compare>
+bool LockFreeList<T, Compare>::remove(T key) {
     bool snip = false;
 
     while (true) {
-        Window window(head, key);
+        Window window(head, tail, key);
         Node *pred = window.pred;
         Node *curr = window.curr;
-        if (curr->key != key) {
+        if (curr == tail || curr->key != key) {
             return false;
         } else {
             Node *succ = curr->next->getReference();
 
-            snip = curr->next->attemptMark(succ, true);
+            snip = curr->next->mark(succ, NULL);
             if (!snip)
                 continue;
+            filterErase(curr);
             pred->next->CAS(curr, succ, false, false);
+            count.add(-1);
+            return true;
+        }
+    }
+}
+
+/*
+ * Atomically replaces oldKey with newKey: no reader sees both keys or
+ * neither. Returns false, leaving the list unchanged, if oldKey is not in
+ * the list or newKey already is.
+ *
+ * The node holding oldKey is first reserved by installing a descriptor as
+ * the owner of its next reference, which blocks remove() and other
+ * replace() calls from marking it. A node holding newKey is then linked
+ * in carrying the same descriptor, and is invisible until the
+ * descriptor's status is set to SUCCEEDED, which atomically hides the old
+ * node. Other updates that meet an undecided descriptor finish it if its
+ * new node is already linked and abort it otherwise, so a stalled
+ * replace() never blocks them.
+ *
+ * Readers may still inspect the descriptor after replace() returns, so
+ * like removed chains it is retired and only freed by reclaim(). Each
+ * call that finds oldKey therefore holds on to one descriptor until the
+ * next reclaim(); workloads that replace keys at a high rate should call
+ * reclaim() at their quiescent points to bound that memory.
+ */
+template <class T, class Compare>
+bool LockFreeList<T, Compare>::replace(T oldKey, T newKey) {
+    if (KeyEqual<T, Compare>()(oldKey, newKey))
+        return contains(oldKey);
+
+    while (true) {
+        Window window(head, tail, oldKey);
+        Node *victim = window.curr;
+        if (victim == tail || victim->key != oldKey)
+            return false;
+
+        // Reserve the node holding oldKey
+        Replace *desc = new Replace;
+        if (!victim->next->CASOwner(NULL, desc)) {
+            delete desc;
+            continue;
+        }
+
+        Node *node = new Node(newKey);
+        node->pending = desc;
+
+        // Link the new node while the reservation still holds
+        bool exists = false;
+        while (desc->status.load() == Replace::UNDECIDED) {
+            Window target(head, tail, newKey);
+            if (target.curr != tail && target.curr->key == newKey) {
+                int expected = Replace::UNDECIDED;
+                desc->status.compare_exchange_strong(expected, Replace::FAILED);
+                exists = true;
+                break;
+            }
+
+            node->next->set(target.curr, false);
+            unsigned side = enterFilter();
+            filterInsert(node);
+            if (target.pred->next->CAS(target.curr, node, false, false)) {
+                filterLinked(node);
+                leaveFilter(side);
+                desc->linked.store(true);
+                break;
+            }
+            filterErase(node);
+            leaveFilter(side);
+        }
+
+        if (decide(desc) == Replace::SUCCEEDED) {
+            // Physically remove the old node. The new node holds its key
+            // for good, so it no longer needs the descriptor.
+            if (markNode(victim))
+                filterErase(victim);
+            node->pending.store(NULL);
+            retire(desc);
+            Window(head, tail, oldKey);
+            return true;
+        }
+
+        // Aborted: release the old node and retract the new one
+        victim->next->CASOwner(desc, NULL);
+        if (desc->linked.load()) {
+            if (markNode(node))
+                filterErase(node);
+            node->pending.store(NULL);
+            Window(head, tail, newKey);
+        } else {
+            delete node;
+        }
+        retire(desc);
+
+        if (exists)
+            return false;
+    }
+}
+
+/*
+ * Removes the smallest key of the list and stores it in key. Returns false
+ * if the list is empty. Marked nodes met on the way from head are snipped
+ * as in the Window traversal, so the list can serve as a lock-free
+ * priority queue.
+ */
+template <class T, class Compare>
+bool LockFreeList<T, Compare>::popMin(T &key) {
+    return popMinRelaxed(key, 1);
+}
+
+/*
+ * Relaxed popMin() in the style of the SprayList: removes one of the
+ * smallest spread keys, picked at random, rather than always the first.
+ * Concurrent callers then mostly try to mark different nodes instead of
+ * all contending on the node after head. A spread of 1 is an exact
+ * popMin().
+ */
+template <class T, class Compare>
+bool LockFreeList<T, Compare>::popMinRelaxed(T &key, std::size_t spread) {
+    thread_local std::minstd_rand random(std::random_device{}());
+
+    while (true) {
+        std::size_t skip = spread > 1 ? random() % spread : 0;
+
+        Node *pred = head;
+        Node *curr = pred->next->getReference();
+        Node *candidate = NULL;
+        // pred moves past the candidate when fewer than skip keys are left
+        Node *before = NULL;
+
+        while (curr != tail) {
+            bool marked;
+            Node *succ = curr->next->get(&marked);
+
+            // Snip marked nodes, restarting if pred changed underneath
+            if (marked) {
+                if (!pred->next->CAS(curr, succ, false, false))
+                    break;
+                curr = succ;
+                continue;
+            }
+            if (settle(curr))
+                continue;
+
+            candidate = curr;
+            before = pred;
+            if (skip-- == 0)
+                break;
+            pred = curr;
+            curr = succ;
+        }
+
+        // Empty, or fewer than skip keys left and all of them are gone
+        if (candidate == NULL) {
+            if (curr == tail)
+                return false;
+            continue;
+        }
+        if (removeNode(before, candidate, key))
+            return true;
+    }
+}
+
+/*
+ * Stores the smallest key of the list in key without removing it. Returns
+ * false if the list is empty. Wait-free like contains().
+ */
+template <class T, class Compare>
+bool LockFreeList<T, Compare>::peekMin(T &key) {
+    for (Node *curr = head->next->getReference(); curr != tail; curr = curr->next->getReference()) {
+        if (present(curr)) {
+            key = curr->key.get();
             return true;
         }
     }
+    return false;
 }
 
 /*
- * Display contents of linked list
+ * Returns the number of keys in the list from per-thread striped counters
+ * updated by successful add() and remove() calls. Cheap, but updates in
+ * flight may or may not be counted.
  */
-template <class T>
-void LockFreeList<T>::printList() {
+template <class T, class Compare>
+std::size_t LockFreeList<T, Compare>::size() const {
+    return count.approximate();
+}
+
+/*
+ * Returns the number of keys in the list. Exact whenever no updates are
+ * in flight; under contention it retries until the counters are stable.
+ */
+template <class T, class Compare>
+std::size_t LockFreeList<T, Compare>::sizeExact() const {
+    return count.exact();
+}
+
+/*
+ * Calls fn on every key of the list, splitting the list into segments
+ * that are processed in parallel on the given number of threads. fn must
+ * be safe to call concurrently. Updates may continue during the call:
+ * keys present for the whole call are visited exactly once, keys added or
+ * removed during the call may or may not be visited, and no key is
+ * visited twice.
+ */
+template <class T, class Compare>
+template <class Function>
+void LockFreeList<T, Compare>::parallelForEach(std::size_t threads, Function fn) {
+    std::vector<Node *> splits = sample(threads * 4);
+
+    runSegments(threads, splits.size(), [&](std::size_t segment) {
+        forEachInSegment(splits, segment, fn);
+    });
+}
+
+/*
+ * Folds every key of the list into a value with reduce, processing
+ * segments in parallel as parallelForEach() does. Each segment is folded
+ * starting from identity and the per-segment results are merged in key
+ * order with combine, so combine only needs to be associative.
+ */
+template <class T, class Compare>
+template <class R, class Reduce, class Combine>
+R LockFreeList<T, Compare>::parallelReduce(std::size_t threads, R identity, Reduce reduce, Combine combine) {
+    std::vector<Node *> splits = sample(threads * 4);
+    std::vector<R> partial(splits.size(), identity);
+
+    runSegments(threads, splits.size(), [&](std::size_t segment) {
+        forEachInSegment(splits, segment, [&](const T &key) {
+            partial[segment] = reduce(partial[segment], key);
+        });
+    });
+
+    R result = identity;
+    for (const R &value : partial)
+        result = combine(result, value);
+    return result;
+}
+
+/*
+ * Replace the contents of the list with the keys of a sorted range. The
+ * new chain is linked privately in one pass, then the old keys are
+ * removed as clear() does and the new chain is published in their place:
+ * concurrent readers see the old keys disappear in key order and then
+ * every new key appear at once. The old chain is retired and freed by
+ * reclaim().
+ */
+template <class T, class Compare>
+template <class InputIt>
+void LockFreeList<T, Compare>::assign(InputIt first, InputIt last) {
+    unsigned side = enterFilter();
+    unsigned long epoch = filterEpoch.load();
+    long length = 0;
+    Node *chain = link(first, last, length);
+
+    Node *old = poisonHead();
+    long cleared = markChain(old);
+    retire(old);
+    head->next->set(chain, false);
+
+    // A filter rebuild may have walked the list before the chain
+    if (filterEpoch.load() != epoch)
+        for (Node *node = chain; node != tail; node = node->next->getReference())
+            filterLinked(node);
+    leaveFilter(side);
+    count.add(length - cleared);
+}
+
+/*
+ * Remove every key from the list. The reference in head is marked first,
+ * so no update can link a node or snip one right after head, then every
+ * node is marked in key order as remove() would, and only then is the
+ * marked chain detached. No node can be linked behind the marking front,
+ * so no key added before clear() returns survives it, and a concurrent
+ * contains() sees the keys disappear one by one in key order. Updates
+ * retry until clear() finishes, so unlike the other operations it is
+ * blocking; it takes one CAS per node. The chain is retired and freed by
+ * reclaim().
+ */
+template <class T, class Compare>
+void LockFreeList<T, Compare>::clear() {
+    Node *old = poisonHead();
+    long cleared = markChain(old);
+    retire(old);
+    head->next->set(tail, false);
+    count.add(-cleared);
+}
+
+/*
+ * Enables a counting Bloom filter with the given number of counters, or
+ * disables it when size is 0. While enabled, contains() answers keys the
+ * filter rules out without touching the list; add() and remove() keep it
+ * up to date, so removals do not leave it stale. Calling it again with a
+ * new size rebuilds the filter from the current keys, which clears
+ * counters saturated by heavy churn. The filter hashes keys with
+ * std::hash, so keys equal under Compare must hash alike.
+ *
+ * Rebuilding is safe while other threads use the list. The new filter is
+ * published as filling under a new epoch, so updates from then on record
+ * their keys in both filters, and the list is then walked to count the
+ * keys already there. An update that recorded its key before that may
+ * link its node after the walk has passed, so it records the key again
+ * once linked if the epoch has changed, and the new filter replaces the
+ * old one only once every such update has done so. Until then contains()
+ * asks the old filter, which counts their keys, so a linked key is never
+ * reported absent. Each node carries the epoch of the newest filter known
+ * to count its key, and a removal only erases the key from filters no
+ * newer than that, so no filter is decremented for a key it does not
+ * count. Counts can be too high, giving false positives, but
+ * never too low. The old filter may still be read and is freed by
+ * reclaim(). Rebuilds are serialized with each other.
+ */
+template <class T, class Compare>
+void LockFreeList<T, Compare>::enableFilter(std::size_t size) {
+    std::lock_guard<std::mutex> guard(filterLock);
+    Filter *current = filter.load();
+    Filter *fresh = NULL;
+
+    if (size > 0) {
+        fresh = new Filter(size, filterEpoch.load() + 1);
+        filling.store(fresh);
+        filterEpoch.store(fresh->epoch);
+
+        for (Node *curr = head->next->getReference(); curr != tail;) {
+            bool marked;
+            Node *succ = curr->next->get(&marked);
+            unsigned long epoch = curr->filtered.load();
+
+            if (!marked && epoch < fresh->epoch) {
+                fresh->insert(curr->key);
+                // Only vouch for the key in both filters if the current
+                // one counts it, it may not yet if its add() is in flight
+                if (current == NULL || epoch >= current->epoch)
+                    stamp(curr, fresh->epoch);
+            }
+            curr = succ;
+        }
+
+        // Wait for updates that entered before the new epoch
+        unsigned side = (fresh->epoch - 1) & 1;
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        while (filterWriters[side].approximate() != 0)
+            std::this_thread::yield();
+        std::atomic_thread_fence(std::memory_order_acquire);
+    }
+
+    filter.store(fresh);
+    filling.store(NULL);
+    if (current != NULL)
+        retiredFilters.push_back(current);
+}
+
+/*
+ * Copy the keys into an immutable FrozenSet for read-only phases. Updates
+ * racing with the copy may or may not be included.
+ */
+template <class T, class Compare>
+FrozenSet<T, Compare> LockFreeList<T, Compare>::freeze(typename FrozenSet<T, Compare>::Layout layout) {
+    std::vector<T> keys;
+    keys.reserve(size());
+    for (Node *curr = head->next->getReference(); curr != tail; curr = curr->next->getReference())
+        if (present(curr))
+            keys.push_back(curr->key);
+    return FrozenSet<T, Compare>(std::move(keys), layout);
+}
+
+/*
+ * Free chains retired by clear() and assign(), the descriptors of
+ * finished replace() calls and filters replaced by enableFilter(). The
+ * caller must ensure no other thread is still operating on the list.
+ */
+template <class T, class Compare>
+void LockFreeList<T, Compare>::reclaim() {
+    Retired *itr = retired.exchange(NULL);
+
+    while (itr != NULL) {
+        Retired *temp = itr;
+        itr = itr->next;
+        freeChain(temp->chain);
+        delete temp;
+    }
+
+    Replace *desc = retiredReplaces.exchange(NULL);
+    while (desc != NULL) {
+        Replace *temp = desc;
+        desc = desc->retiredNext;
+        delete temp;
+    }
+
+    std::lock_guard<std::mutex> guard(filterLock);
+    for (Filter *old : retiredFilters)
+        delete old;
+    retiredFilters.clear();
+}
+
+/*
+ * Display contents of linked list, skipping nodes that do not hold their
+ * key, as present() tells
+ */
+template <class T, class Compare>
+void LockFreeList<T, Compare>::printList() {
     // Set curr to head->next since head is a sentinel node
-    Node *curr = head;
+    Node *curr = head->next->getReference();
 
     // Traverse linked list and display contents
-    while (curr != NULL) {
-        cout << curr->key << " ";
+    while (curr != tail) {
+        if (present(curr))
+            cout << curr->key << " ";
         curr = curr->next->getReference();
     }
 }
 
 /*
- * Delete contents of linked list
+ * Returns the final status of a replace() descriptor, deciding it if it is
+ * still undecided: a descriptor whose new node is linked succeeds, any
+ * other is aborted.
  */
-template <class T>
-void LockFreeList<T>::deleteList() {
-    Node *temp;
+template <class T, class Compare>
+int LockFreeList<T, Compare>::decide(Replace *desc) {
+    int status = desc->status.load();
+    if (status == Replace::UNDECIDED) {
+        int target = desc->linked.load() ? Replace::SUCCEEDED : Replace::FAILED;
+        if (desc->status.compare_exchange_strong(status, target))
+            return target;
+    }
+    return status;
+}
 
-    while (head->next->getReference() != tail) {
-        temp = head->next->getReference();
-        head->next = temp->next;
-        delete temp;
+/*
+ * Tests whether a node logically holds its key: it must be unmarked, not
+ * the new node of an undecided or failed replace(), and not the old node
+ * of a successful one
+ */
+template <class T, class Compare>
+bool LockFreeList<T, Compare>::present(Node *node) {
+    // replace() marks a failed new node before dropping its descriptor, so
+    // reading the descriptor first never misses both
+    Replace *pending = node->pending.load();
+    if (pending != NULL && pending->status.load() != Replace::SUCCEEDED)
+        return false;
+
+    bool marked;
+    void *owner;
+    node->next->get(&marked, &owner);
+
+    if (marked)
+        return false;
+    return owner == NULL || static_cast<Replace *>(owner)->status.load() != Replace::SUCCEEDED;
+}
+
+/*
+ * Decides any replace() the node takes part in and applies the outcome:
+ * the new node of a failed replace and the old node of a successful one
+ * are marked, and the reservation of a failed one is released. Returns
+ * true if the node was marked.
+ */
+template <class T, class Compare>
+bool LockFreeList<T, Compare>::settle(Node *node) {
+    Replace *pending = node->pending.load();
+    if (pending != NULL && decide(pending) == Replace::FAILED) {
+        markNode(node);
+        return true;
     }
 
-    delete head;
-    delete tail;
+    bool marked;
+    void *owner;
+    node->next->get(&marked, &owner);
+    if (marked || owner == NULL)
+        return marked;
 
-    head = new Node(INT_MIN);
+    if (decide(static_cast<Replace *>(owner)) == Replace::SUCCEEDED) {
+        markNode(node);
+        return true;
+    }
+    node->next->CASOwner(owner, NULL);
+    return false;
+}
 
-    tail = new Node(INT_MAX);
+/*
+ * Logically removes a node found by a traversal and tries to snip it from
+ * pred. Fails if the node was marked or reserved in the meantime.
+ */
+template <class T, class Compare>
+bool LockFreeList<T, Compare>::removeNode(Node *pred, Node *node, T &key) {
+    Node *succ = node->next->getReference();
+    if (!node->next->mark(succ, NULL))
+        return false;
 
-    /* Set next of head to tail
-     * and next of tail will be NULL, false due to default constructors */
+    key = node->key.get();
+    count.add(-1);
+    filterErase(node);
+
+    // Physical removal, left to later traversals if pred has changed
+    pred->next->CAS(node, succ, false, false);
+    return true;
+}
+
+/*
+ * Marks a node whatever its current owner. Returns false if it was
+ * already marked.
+ */
+template <class T, class Compare>
+bool LockFreeList<T, Compare>::markNode(Node *node) {
+    while (true) {
+        bool marked;
+        void *owner;
+        Node *succ = node->next->get(&marked, &owner);
+        if (marked)
+            return false;
+        if (node->next->mark(succ, owner))
+            return true;
+    }
+}
+
+/*
+ * Mark the reference in head, waiting for a clear() or assign() already
+ * holding it, and return the first node. While it is marked every CAS on
+ * it fails, so the first node stays put and nothing is linked before it.
+ */
+template <class T, class Compare>
+typename LockFreeList<T, Compare>::Node *LockFreeList<T, Compare>::poisonHead() {
+    while (true) {
+        bool marked;
+        Node *first = head->next->get(&marked);
+        if (!marked && head->next->mark(first, NULL))
+            return first;
+        std::this_thread::yield();
+    }
+}
+
+/*
+ * Mark every node from curr on, settling any replace() on a node first
+ * as remove() does, and return how many of them held their key. Called
+ * with head poisoned: a node can only be linked behind an unmarked one,
+ * which the walk has not reached yet, and the next reference of a marked
+ * node never changes, so no node of the chain is left unmarked.
+ */
+template <class T, class Compare>
+long LockFreeList<T, Compare>::markChain(Node *curr) {
+    long cleared = 0;
+
+    while (curr != tail) {
+        while (!settle(curr)) {
+            Node *succ = curr->next->getReference();
+            if (curr->next->mark(succ, NULL)) {
+                filterErase(curr);
+                cleared++;
+                break;
+            }
+        }
+        curr = curr->next->getReference();
+    }
+    return cleared;
+}
+
+/*
+ * Counts the calling update as recording a key until leaveFilter(), so a
+ * filter rebuild waits for it before publishing. An update that read an
+ * epoch replaced meanwhile enters again under the new one.
+ */
+template <class T, class Compare>
+unsigned LockFreeList<T, Compare>::enterFilter() {
+    while (true) {
+        unsigned long epoch = filterEpoch.load();
+        filterWriters[epoch & 1].add(1);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (filterEpoch.load() == epoch)
+            return epoch & 1;
+        filterWriters[epoch & 1].add(-1);
+    }
+}
+
+template <class T, class Compare>
+void LockFreeList<T, Compare>::leaveFilter(unsigned side) {
+    std::atomic_thread_fence(std::memory_order_release);
+    filterWriters[side].add(-1);
+}
+
+/*
+ * Record the key of a node about to be linked in the filter, if enabled,
+ * and in the one being built, if any. The node is stamped with the epoch
+ * read before loading them, which every filter published by then counts.
+ */
+template <class T, class Compare>
+void LockFreeList<T, Compare>::filterInsert(Node *node) {
+    unsigned long epoch = filterEpoch.load();
+    Filter *next = filling.load();
+    Filter *bloom = filter.load();
+    if (bloom != NULL)
+        bloom->insert(node->key);
+    if (next != NULL && next != bloom)
+        next->insert(node->key);
+    stamp(node, epoch);
+}
+
+/*
+ * Called once a node is linked. A rebuild published since its key was
+ * recorded may have walked past its position first, record it again.
+ */
+template <class T, class Compare>
+void LockFreeList<T, Compare>::filterLinked(Node *node) {
+    if (filterEpoch.load() != node->filtered.load())
+        filterInsert(node);
+}
+
+/*
+ * Drop the key of a node from the filters that count it, once it is no
+ * longer visible
+ */
+template <class T, class Compare>
+void LockFreeList<T, Compare>::filterErase(Node *node) {
+    unsigned long epoch = node->filtered.load();
+    Filter *next = filling.load();
+    Filter *bloom = filter.load();
+    if (bloom != NULL && bloom->epoch <= epoch)
+        bloom->erase(node->key);
+    if (next != NULL && next != bloom && next->epoch <= epoch)
+        next->erase(node->key);
+}
+
+/*
+ * Raise the filter epoch of a node, never lowering it
+ */
+template <class T, class Compare>
+void LockFreeList<T, Compare>::stamp(Node *node, unsigned long epoch) {
+    unsigned long prev = node->filtered.load();
+    while (prev < epoch && !node->filtered.compare_exchange_weak(prev, epoch))
+        ;
+}
+
+/*
+ * Link the keys of a sorted range into a private chain ending at tail and
+ * return its first node. The number of nodes linked is added to length.
+ */
+template <class T, class Compare>
+template <class InputIt>
+typename LockFreeList<T, Compare>::Node *LockFreeList<T, Compare>::link(InputIt first, InputIt last, long &length) {
+    Node *chain = tail;
+    Node *prev = NULL;
+
+    for (; first != last; ++first) {
+        // Skip duplicate keys
+        if (prev != NULL && prev->key == *first)
+            continue;
+
+        Node *node = new Node(*first);
+        filterInsert(node);
+        node->next->set(tail, false);
+
+        if (prev == NULL)
+            chain = node;
+        else
+            prev->next->set(node, false);
+        prev = node;
+        length++;
+    }
+    return chain;
+}
+
+/*
+ * Walks the list once and picks up to the given number of nodes holding
+ * their key, evenly spaced according to size(), as the first nodes of the
+ * segments
+ */
+template <class T, class Compare>
+std::vector<typename LockFreeList<T, Compare>::Node *> LockFreeList<T, Compare>::sample(std::size_t segments) {
+    std::vector<Node *> splits;
+    std::size_t stride = size() / (segments ? segments : 1) + 1;
+    std::size_t i = 0;
+
+    for (Node *curr = head->next->getReference(); curr != tail; curr = curr->next->getReference())
+        if (present(curr) && i++ % stride == 0)
+            splits.push_back(curr);
+    return splits;
+}
+
+/*
+ * Calls fn on every node holding its key, as present() tells, from the
+ * first node of the segment up to the first key of the next segment.
+ * Ending on a key rather than a node keeps the segments disjoint even if
+ * the next split node is removed.
+ */
+template <class T, class Compare>
+template <class Function>
+void LockFreeList<T, Compare>::forEachInSegment(const std::vector<Node *> &splits, std::size_t segment, Function fn) {
+    Node *curr = splits[segment];
+    Node *next = segment + 1 < splits.size() ? splits[segment + 1] : tail;
+
+    while (curr != tail && (next == tail || curr->key < next->key)) {
+        if (present(curr))
+            fn(curr->key);
+        curr = curr->next->getReference();
+    }
+}
+
+/*
+ * Push a detached chain onto the retired stack
+ */
+template <class T, class Compare>
+void LockFreeList<T, Compare>::retire(Node *chain) {
+    if (chain == tail)
+        return;
+
+    Retired *node = new Retired(chain, retired.load());
+    while (!retired.compare_exchange_weak(node->next, node))
+        ;
+}
+
+/*
+ * Push the descriptor of a finished replace() onto its retired stack. No
+ * node refers to it any more, but other threads may still be reading it.
+ */
+template <class T, class Compare>
+void LockFreeList<T, Compare>::retire(Replace *desc) {
+    desc->retiredNext = retiredReplaces.load();
+    while (!retiredReplaces.compare_exchange_weak(desc->retiredNext, desc))
+        ;
+}
+
+/*
+ * Free every node of a chain up to the tail sentinel
+ */
+template <class T, class Compare>
+void LockFreeList<T, Compare>::freeChain(Node *curr) {
+    while (curr != tail) {
+        Node *temp = curr;
+        curr = curr->next->getReference();
+        delete temp;
+    }
+}
+
+/*
+ * Delete contents of linked list
+ */
+template <class T, class Compare>
+void LockFreeList<T, Compare>::deleteList() {
+    freeChain(head->next->getReference());
     head->next->set(tail, false);
+    count.reset();
+
+    reclaim();
 }
@@ -0,0 +1,76 @@
+/*************************************************************************
+ * Lock-free Priority Queue
+ *
+ * A concurrent priority queue on top of the lock-free list, which already
+ * keeps its keys sorted with lock-free insertion. push() is the list's
+ * add(), and popMin() marks and snips the first unmarked node after head.
+ * With a spread greater than 1, popMin() instead removes one of the
+ * spread smallest keys at random, in the style of the SprayList. That
+ * trades strict ordering for less contention on the front of the list.
+ *
+ * Keys are unique: pushing a key that is already queued returns false.
+ * The smallest key is the first in Compare order.
+ *
+ * **********************************************************************/
+#pragma once
+
+#include "LockFreeList.hpp"
+
+template <class T, class Compare = std::less<T>>
+class LockFreePriorityQueue {
+   public:
+    LockFreePriorityQueue(std::size_t = 1);
+    bool push(T);
+    bool popMin(T &);
+    bool peekMin(T &);
+    bool empty();
+    std::size_t size() const;
+
+   private:
+    LockFreeList<T, Compare> list;
+    std::size_t spread;
+};
+
+/*
+ * Create an empty queue. spread is the number of smallest keys popMin()
+ * picks from at random; 1 keeps the queue exact.
+ */
+template <class T, class Compare>
+LockFreePriorityQueue<T, Compare>::LockFreePriorityQueue(std::size_t mySpread) : spread(mySpread ? mySpread : 1) {}
+
+/*
+ * Insert a key. Returns false if the key is already queued.
+ */
+template <class T, class Compare>
+bool LockFreePriorityQueue<T, Compare>::push(T key) {
+    return list.add(key);
+}
+
+/*
+ * Remove the smallest key, or one of the spread smallest, into key.
+ * Returns false if the queue is empty.
+ */
+template <class T, class Compare>
+bool LockFreePriorityQueue<T, Compare>::popMin(T &key) {
+    return list.popMinRelaxed(key, spread);
+}
+
+/*
+ * Read the smallest key into key without removing it. Returns false if the
+ * queue is empty.
+ */
+template <class T, class Compare>
+bool LockFreePriorityQueue<T, Compare>::peekMin(T &key) {
+    return list.peekMin(key);
+}
+
+template <class T, class Compare>
+bool LockFreePriorityQueue<T, Compare>::empty() {
+    T key;
+    return !list.peekMin(key);
+}
+
+template <class T, class Compare>
+std::size_t LockFreePriorityQueue<T, Compare>::size() const {
+    return list.size();
+}
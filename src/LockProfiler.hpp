@@ -0,0 +1,389 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <ostream>
+#include <sstream>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "BenchmarkStats.hpp"
+
+/*
+ * Collects lock wait and hold times from ProfiledMutex. Every thread logs
+ * into its own buffers: a wait and a hold histogram per operation type, a
+ * table of contended keys sampled by lock wait, and a bounded timeline of
+ * lock events. Operations tag the locks they take with a Scope naming the
+ * operation and key.
+ *
+ * Reading the results is not thread-safe: call the report functions once
+ * the profiled threads are done.
+ */
+class LockProfiler {
+   public:
+    enum Op { CONTAINS, ADD, REMOVE, OTHER, OPS };
+
+    /*
+     * Attributes the locks taken by the calling thread to an operation,
+     * and to a key if one is given, until the scope ends. The key is only
+     * formatted when the scope ends, after the locks it tagged have been
+     * released, and only if one of their waits was sampled.
+     */
+    class Scope {
+       private:
+        Op op;
+        const void *key;
+        void (*format)(const void *, std::string &);
+        Scope *outer;
+        // Estimated wait of the sampled waits, and the first event they
+        // may have logged
+        std::uint64_t sampled;
+        std::size_t firstEvent;
+
+        template <class K>
+        static void formatKey(const void *key, std::string &out) {
+            std::ostringstream os;
+            os << *static_cast<const K *>(key);
+            out = os.str();
+        }
+
+        friend class LockProfiler;
+
+       public:
+        Scope(Op myOp) : op(myOp), key(nullptr), format(nullptr), outer(current()), sampled(0), firstEvent(0) {
+            current() = this;
+        }
+
+        template <class K>
+        Scope(Op myOp, const K &myKey)
+            : op(myOp), key(&myKey), format(&formatKey<K>), outer(current()), sampled(0), firstEvent(0) {
+            current() = this;
+        }
+
+        // A try_lock() wait still pending here was given up on
+        ~Scope() {
+            pending().mutex = nullptr;
+            current() = outer;
+            if (sampled != 0)
+                instance().label(*this);
+        }
+
+        Scope(const Scope &) = delete;
+        Scope &operator=(const Scope &) = delete;
+    };
+
+    static LockProfiler &instance() {
+        static LockProfiler profiler;
+        return profiler;
+    }
+
+    static std::uint64_t now() {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+                   std::chrono::steady_clock::now().time_since_epoch())
+            .count();
+    }
+
+    static const char *name(Op op) {
+        static const char *const names[OPS] = {"contains", "add", "remove", "other"};
+        return names[op];
+    }
+
+    // A wait of 0 is an uncontended acquisition
+    void recordWait(std::uint64_t start, std::uint64_t nanos) {
+        Log &log = local();
+        Scope *scope = current();
+        Op op = scope ? scope->op : OTHER;
+
+        log.waits[op].record(nanos);
+        if (nanos == 0)
+            return;
+
+        // Called with the lock just taken, so the key is left for the
+        // scope to format once it ends
+        Scope *owner = nullptr;
+        if (scope && scope->key && log.contended++ % SAMPLE_EVERY == 0) {
+            if (scope->sampled == 0)
+                scope->firstEvent = log.events.size();
+            scope->sampled += nanos * SAMPLE_EVERY;
+            owner = scope;
+        }
+        trace(log, "wait", op, start, nanos, owner);
+    }
+
+    void recordHold(std::uint64_t start, std::uint64_t nanos) {
+        Log &log = local();
+        Scope *scope = current();
+        Op op = scope ? scope->op : OTHER;
+
+        log.holds[op].record(nanos);
+        trace(log, "hold", op, start, nanos, nullptr);
+    }
+
+    LatencyHistogram waits(Op op) const {
+        LatencyHistogram merged;
+        std::lock_guard<std::mutex> guard(logsLock);
+        for (const Log *log : logs)
+            merged.merge(log->waits[op]);
+        return merged;
+    }
+
+    LatencyHistogram holds(Op op) const {
+        LatencyHistogram merged;
+        std::lock_guard<std::mutex> guard(logsLock);
+        for (const Log *log : logs)
+            merged.merge(log->holds[op]);
+        return merged;
+    }
+
+    // Estimated total wait per key, highest first
+    std::vector<std::pair<std::string, std::uint64_t>> hotKeys(std::size_t limit) const {
+        std::unordered_map<std::string, std::uint64_t> totals;
+        {
+            std::lock_guard<std::mutex> guard(logsLock);
+            for (const Log *log : logs)
+                for (const auto &entry : log->hotKeys)
+                    totals[entry.first] += entry.second;
+        }
+
+        std::vector<std::pair<std::string, std::uint64_t>> sorted(totals.begin(), totals.end());
+        std::sort(sorted.begin(), sorted.end(),
+                  [](const std::pair<std::string, std::uint64_t> &a, const std::pair<std::string, std::uint64_t> &b) {
+                      return a.second > b.second;
+                  });
+        if (sorted.size() > limit)
+            sorted.resize(limit);
+        return sorted;
+    }
+
+    void writeSummary(std::ostream &os, std::size_t hottest = 10) const {
+        os << "op,waits,wait_p50_ns,wait_p99_ns,wait_max_ns,hold_p50_ns,hold_p99_ns,hold_max_ns\n";
+        for (int i = 0; i < OPS; i++) {
+            Op op = static_cast<Op>(i);
+            LatencyHistogram wait = waits(op);
+            LatencyHistogram hold = holds(op);
+            if (wait.count() == 0)
+                continue;
+            os << name(op) << "," << wait.count() << "," << wait.percentile(50) << "," << wait.percentile(99) << ","
+               << wait.max() << "," << hold.percentile(50) << "," << hold.percentile(99) << "," << hold.max()
+               << "\n";
+        }
+
+        os << "key,estimated_wait_ns\n";
+        for (const auto &entry : hotKeys(hottest))
+            os << entry.first << "," << entry.second << "\n";
+    }
+
+    /*
+     * Write the recorded lock events in the Chrome trace-event format, one
+     * timeline row per thread, for chrome://tracing or Perfetto
+     */
+    void writeChromeTrace(std::ostream &os) const {
+        std::lock_guard<std::mutex> guard(logsLock);
+        bool first = true;
+
+        os << "{\"traceEvents\":[";
+        for (const Log *log : logs) {
+            for (const Event &event : log->events) {
+                os << (first ? "\n" : ",\n");
+                os << "{\"name\":\"" << event.kind << " " << name(event.op) << "\",\"cat\":\"lock\",\"ph\":\"X\""
+                   << ",\"ts\":" << (event.start > epoch ? event.start - epoch : 0) / 1000.0 << ",\"dur\":" << event.nanos / 1000.0
+                   << ",\"pid\":1,\"tid\":" << log->id;
+                if (!event.key.empty()) {
+                    os << ",\"args\":{\"key\":\"";
+                    escape(os, event.key);
+                    os << "\"}";
+                }
+                os << "}";
+                first = false;
+            }
+        }
+        os << "\n]}\n";
+    }
+
+    void reset() {
+        std::lock_guard<std::mutex> guard(logsLock);
+        for (Log *log : logs) {
+            for (int i = 0; i < OPS; i++) {
+                log->waits[i].reset();
+                log->holds[i].reset();
+            }
+            log->events.clear();
+            log->hotKeys.clear();
+            log->contended = 0;
+        }
+        epoch = now();
+    }
+
+   private:
+    static const std::uint64_t SAMPLE_EVERY = 16;
+    static const std::size_t MAX_EVENTS = 1 << 16;
+
+    struct Event {
+        const char *kind;
+        Op op;
+        std::uint64_t start;
+        std::uint64_t nanos;
+        std::string key;
+        // Scope still to label a sampled wait with its key
+        const Scope *owner;
+    };
+
+    struct Log {
+        int id;
+        LatencyHistogram waits[OPS];
+        LatencyHistogram holds[OPS];
+        std::unordered_map<std::string, std::uint64_t> hotKeys;
+        std::vector<Event> events;
+        std::uint64_t contended;
+
+        Log(int myId) : id(myId), contended(0) {}
+    };
+
+    // Logs outlive their threads so results survive worker exit
+    std::vector<Log *> logs;
+    mutable std::mutex logsLock;
+    std::uint64_t epoch;
+
+    LockProfiler() : epoch(now()) {}
+
+    ~LockProfiler() {
+        for (Log *log : logs)
+            delete log;
+    }
+
+    // The mutex the calling thread is retrying try_lock() on, if any
+    struct Pending {
+        const void *mutex;
+        std::uint64_t since;
+    };
+
+    friend class ProfiledMutex;
+
+    static Pending &pending() {
+        thread_local Pending waiting = {nullptr, 0};
+        return waiting;
+    }
+
+    static Scope *&current() {
+        thread_local Scope *scope = nullptr;
+        return scope;
+    }
+
+    Log &local() {
+        thread_local Log *log = nullptr;
+        if (log == nullptr) {
+            std::lock_guard<std::mutex> guard(logsLock);
+            log = new Log(static_cast<int>(logs.size()) + 1);
+            logs.push_back(log);
+        }
+        return *log;
+    }
+
+    // Sampled waits are labelled with their key by label()
+    static void trace(Log &log, const char *kind, Op op, std::uint64_t start, std::uint64_t nanos,
+                      const Scope *owner) {
+        if (log.events.size() < MAX_EVENTS)
+            log.events.push_back({kind, op, start, nanos, std::string(), owner});
+    }
+
+    // Format the key of a scope with sampled waits as it ends, and charge
+    // their wait to it
+    void label(const Scope &scope) {
+        Log &log = local();
+        std::string key;
+        scope.format(scope.key, key);
+        log.hotKeys[key] += scope.sampled;
+
+        for (std::size_t i = scope.firstEvent; i < log.events.size(); i++) {
+            if (log.events[i].owner == &scope) {
+                log.events[i].key = key;
+                log.events[i].owner = nullptr;
+            }
+        }
+    }
+
+    static void escape(std::ostream &os, const std::string &text) {
+        for (char c : text) {
+            if (c == '"' || c == '\\')
+                os << '\\' << c;
+            else if (static_cast<unsigned char>(c) < 0x20)
+                os << ' ';
+            else
+                os << c;
+        }
+    }
+};
+
+/*
+ * Drop-in replacement for std::mutex that reports how long each
+ * acquisition waited and how long the lock was then held. Waits through
+ * repeated try_lock() calls, as in acquire(), are measured from the first
+ * failed attempt.
+ */
+class ProfiledMutex {
+   private:
+    std::mutex mutex;
+    std::uint64_t acquired;
+
+   public:
+    ProfiledMutex() : acquired(0) {}
+
+    ProfiledMutex(const ProfiledMutex &) = delete;
+    ProfiledMutex &operator=(const ProfiledMutex &) = delete;
+
+    void lock() {
+        std::uint64_t start = LockProfiler::now();
+        if (!mutex.try_lock()) {
+            mutex.lock();
+            acquired = LockProfiler::now();
+            LockProfiler::instance().recordWait(start, acquired - start);
+            return;
+        }
+        acquired = start;
+        LockProfiler::instance().recordWait(start, 0);
+    }
+
+    bool try_lock() {
+        LockProfiler::Pending &waiting = LockProfiler::pending();
+        std::uint64_t start = LockProfiler::now();
+
+        if (!mutex.try_lock()) {
+            if (waiting.mutex != this)
+                waiting = {this, start};
+            return false;
+        }
+
+        acquired = start;
+        if (waiting.mutex == this) {
+            LockProfiler::instance().recordWait(waiting.since, start - waiting.since);
+            waiting.mutex = nullptr;
+        } else {
+            LockProfiler::instance().recordWait(start, 0);
+        }
+        return true;
+    }
+
+    void unlock() {
+        std::uint64_t start = acquired;
+        std::uint64_t held = LockProfiler::now() - start;
+        mutex.unlock();
+        LockProfiler::instance().recordHold(start, held);
+    }
+};
+
+/*
+ * Node locks are profiled when CONCURRENTLIST_PROFILE_LOCKS is defined
+ * before the lists are included, e.g. with -DCONCURRENTLIST_PROFILE_LOCKS.
+ * Otherwise they are plain mutexes and PROFILE_LOCKS compiles to nothing.
+ */
+#ifdef CONCURRENTLIST_PROFILE_LOCKS
+typedef ProfiledMutex NodeMutex;
+#define PROFILE_LOCKS(...) LockProfiler::Scope lockProfilerScope(LockProfiler::__VA_ARGS__)
+#else
+typedef std::mutex NodeMutex;
+#define PROFILE_LOCKS(...)
+#endif
@@ -0,0 +1,331 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <ostream>
+#include <string>
+#include <type_traits>
+
+/*
+ * Order-preserving 64-bit prefix of a key: whenever of(a) < of(b) then
+ * a < b. Specialize it for a key type to store that type out of line
+ * with the prefix cached in the node, so traversals can decide most
+ * comparisons without dereferencing the key.
+ */
+template <class T>
+struct KeyPrefix {
+    static const bool enabled = false;
+};
+
+// The first eight bytes in big-endian order, compared like memcmp the same
+// way std::string is
+template <class CharT, class Traits, class Alloc>
+struct KeyPrefix<std::basic_string<CharT, Traits, Alloc>> {
+    static const bool enabled = sizeof(CharT) == 1;
+
+    static std::uint64_t of(const std::basic_string<CharT, Traits, Alloc> &key) {
+        std::uint64_t prefix = 0;
+        std::size_t length = key.size() < 8 ? key.size() : 8;
+        for (std::size_t i = 0; i < length; i++)
+            prefix |= static_cast<std::uint64_t>(static_cast<unsigned char>(key[i])) << (56 - 8 * i);
+        return prefix;
+    }
+};
+
+/*
+ * Two keys are equal under Compare when neither orders before the other.
+ * Under std::less that is operator==, one comparison instead of two.
+ */
+template <class T, class Compare>
+struct KeyEqual {
+    bool operator()(const T &a, const T &b) const {
+        return !Compare()(a, b) && !Compare()(b, a);
+    }
+};
+
+template <class T>
+struct KeyEqual<T, std::less<T>> {
+    bool operator()(const T &a, const T &b) const {
+        return a == b;
+    }
+};
+
+/*
+ * Where a list node keeps its key, chosen at compile time from the key
+ * type and its order:
+ *  - INLINE for small and medium keys, stored in the node. The node's
+ *    flags are declared right after the key, so a key smaller than a
+ *    pointer shares its word with them instead of being padded.
+ *  - OUT_OF_LINE for keys larger than a cache line, so a traversal walks
+ *    small nodes and only loads the keys it compares.
+ *  - PREFIXED for key types with KeyPrefix enabled under std::less, the
+ *    order the prefix preserves: the key is out of line and the node
+ *    caches its prefix, so most comparisons never dereference the key.
+ */
+enum class KeyStorage { INLINE, OUT_OF_LINE, PREFIXED };
+
+template <class T, class Compare>
+struct KeyLayout {
+    static const std::size_t LARGE = 64;
+
+    static const KeyStorage storage =
+        KeyPrefix<T>::enabled && std::is_same<Compare, std::less<T>>::value ? KeyStorage::PREFIXED
+        : sizeof(T) > LARGE                                                  ? KeyStorage::OUT_OF_LINE
+                                                                             : KeyStorage::INLINE;
+};
+
+/*
+ * The key an operation searches for. Traversals build one per operation
+ * and compare nodes against it, so the prefix of a PREFIXED key is
+ * computed once rather than at every node visited.
+ */
+template <class T, class Compare = std::less<T>, KeyStorage Storage = KeyLayout<T, Compare>::storage>
+class KeyProbe {
+   private:
+    const T &value;
+
+   public:
+    explicit KeyProbe(const T &key) : value(key) {}
+
+    const T &get() const {
+        return value;
+    }
+};
+
+template <class T, class Compare>
+class KeyProbe<T, Compare, KeyStorage::PREFIXED> {
+   private:
+    const T &value;
+    std::uint64_t prefix;
+
+   public:
+    explicit KeyProbe(const T &key) : value(key), prefix(KeyPrefix<T>::of(key)) {}
+
+    const T &get() const {
+        return value;
+    }
+
+    std::uint64_t prefixOf() const {
+        return prefix;
+    }
+};
+
+/*
+ * Storage for the key of a list node, laid out as KeyLayout chooses. Keys
+ * are compared with Compare, which must be default constructible, either
+ * against a plain key or against a KeyProbe.
+ */
+template <class T, class Compare = std::less<T>, KeyStorage Storage = KeyLayout<T, Compare>::storage>
+class NodeKey {
+   private:
+    T value;
+
+   public:
+    typedef KeyProbe<T, Compare, Storage> Probe;
+
+    NodeKey() : value() {}
+    NodeKey(const T &key) : value(key) {}
+
+    NodeKey &operator=(const T &key) {
+        value = key;
+        return *this;
+    }
+
+    const T &get() const {
+        return value;
+    }
+
+    operator const T &() const {
+        return value;
+    }
+
+    bool less(const T &key) const {
+        return Compare()(value, key);
+    }
+
+    bool greater(const T &key) const {
+        return Compare()(key, value);
+    }
+
+    bool equals(const T &key) const {
+        return KeyEqual<T, Compare>()(value, key);
+    }
+
+    bool less(const Probe &probe) const {
+        return less(probe.get());
+    }
+
+    bool greater(const Probe &probe) const {
+        return greater(probe.get());
+    }
+
+    bool equals(const Probe &probe) const {
+        return equals(probe.get());
+    }
+};
+
+template <class T, class Compare>
+class NodeKey<T, Compare, KeyStorage::OUT_OF_LINE> {
+   private:
+    T *value;
+
+   public:
+    typedef KeyProbe<T, Compare, KeyStorage::OUT_OF_LINE> Probe;
+
+    NodeKey() : value(new T()) {}
+    NodeKey(const T &key) : value(new T(key)) {}
+
+    ~NodeKey() {
+        delete value;
+    }
+
+    NodeKey(const NodeKey &) = delete;
+    NodeKey &operator=(const NodeKey &) = delete;
+
+    NodeKey &operator=(const T &key) {
+        *value = key;
+        return *this;
+    }
+
+    const T &get() const {
+        return *value;
+    }
+
+    operator const T &() const {
+        return *value;
+    }
+
+    bool less(const T &key) const {
+        return Compare()(*value, key);
+    }
+
+    bool greater(const T &key) const {
+        return Compare()(key, *value);
+    }
+
+    bool equals(const T &key) const {
+        return KeyEqual<T, Compare>()(*value, key);
+    }
+
+    bool less(const Probe &probe) const {
+        return less(probe.get());
+    }
+
+    bool greater(const Probe &probe) const {
+        return greater(probe.get());
+    }
+
+    bool equals(const Probe &probe) const {
+        return equals(probe.get());
+    }
+};
+
+template <class T, class Compare>
+class NodeKey<T, Compare, KeyStorage::PREFIXED> {
+   private:
+    T *value;
+    std::uint64_t prefix;
+
+   public:
+    typedef KeyProbe<T, Compare, KeyStorage::PREFIXED> Probe;
+
+    NodeKey() : value(new T()), prefix(KeyPrefix<T>::of(*value)) {}
+    NodeKey(const T &key) : value(new T(key)), prefix(KeyPrefix<T>::of(key)) {}
+
+    ~NodeKey() {
+        delete value;
+    }
+
+    NodeKey(const NodeKey &) = delete;
+    NodeKey &operator=(const NodeKey &) = delete;
+
+    NodeKey &operator=(const T &key) {
+        *value = key;
+        prefix = KeyPrefix<T>::of(key);
+        return *this;
+    }
+
+    const T &get() const {
+        return *value;
+    }
+
+    operator const T &() const {
+        return *value;
+    }
+
+    bool less(const T &key) const {
+        return less(Probe(key));
+    }
+
+    bool greater(const T &key) const {
+        return greater(Probe(key));
+    }
+
+    bool equals(const T &key) const {
+        return equals(Probe(key));
+    }
+
+    bool less(const Probe &probe) const {
+        std::uint64_t other = probe.prefixOf();
+        return prefix != other ? prefix < other : Compare()(*value, probe.get());
+    }
+
+    bool greater(const Probe &probe) const {
+        std::uint64_t other = probe.prefixOf();
+        return prefix != other ? prefix > other : Compare()(probe.get(), *value);
+    }
+
+    bool equals(const Probe &probe) const {
+        return prefix == probe.prefixOf() && KeyEqual<T, Compare>()(*value, probe.get());
+    }
+};
+
+template <class T, class C, KeyStorage S, class K>
+bool operator<(const NodeKey<T, C, S> &a, const K &b) {
+    return a.less(b);
+}
+
+template <class T, class C, KeyStorage S, class K>
+bool operator<=(const NodeKey<T, C, S> &a, const K &b) {
+    return !a.greater(b);
+}
+
+template <class T, class C, KeyStorage S, class K>
+bool operator>(const NodeKey<T, C, S> &a, const K &b) {
+    return a.greater(b);
+}
+
+template <class T, class C, KeyStorage S, class K>
+bool operator>=(const NodeKey<T, C, S> &a, const K &b) {
+    return !a.less(b);
+}
+
+template <class T, class C, KeyStorage S, class K>
+bool operator==(const NodeKey<T, C, S> &a, const K &b) {
+    return a.equals(b);
+}
+
+template <class T, class C, KeyStorage S, class K>
+bool operator!=(const NodeKey<T, C, S> &a, const K &b) {
+    return !a.equals(b);
+}
+
+template <class T, class C, KeyStorage S>
+bool operator<(const NodeKey<T, C, S> &a, const NodeKey<T, C, S> &b) {
+    return a.less(b.get());
+}
+
+template <class T, class C, KeyStorage S>
+bool operator>(const NodeKey<T, C, S> &a, const NodeKey<T, C, S> &b) {
+    return a.greater(b.get());
+}
+
+template <class T, class C, KeyStorage S>
+bool operator==(const NodeKey<T, C, S> &a, const NodeKey<T, C, S> &b) {
+    return a.equals(b.get());
+}
+
+template <class T, class C, KeyStorage S>
+std::ostream &operator<<(std::ostream &os, const NodeKey<T, C, S> &key) {
+    return os << key.get();
+}
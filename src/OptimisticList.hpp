@@ -11,13 +11,23 @@
  * nodes to be locked, then release the locks and start over. Normally this
  * kind of conflict is rare.
  *
+ * Keys are kept in the order given by Compare. The head and tail
+ * sentinels hold no key and are recognized by address, so every value of
+ * the key type can be stored.
+ *
  * **********************************************************************/
 #pragma once
 
+#include <functional>
 #include <iostream>
 #include <mutex>
 
-template <class T>
+#include "LockProfiler.hpp"
+#include "NodeKey.hpp"
+#include "StripedCounter.hpp"
+#include "TryLock.hpp"
+
+template <class T, class Compare = std::less<T>>
 class OptimisticList {
    public:
     OptimisticList();
@@ -25,31 +35,38 @@ class OptimisticList {
     bool contains(T);
     bool add(T);
     bool remove(T);
+    TryResult tryAdd(T, std::size_t = DEFAULT_SPINS);
+    TryResult tryRemove(T, std::size_t = DEFAULT_SPINS);
+    std::size_t size() const;
+    std::size_t sizeExact() const;
     void printList();
     void deleteList();
 
+    static const std::size_t DEFAULT_SPINS = 64;
+
    private:
+    typedef typename NodeKey<T, Compare>::Probe Probe;
+
     struct Node {
-        T key;
+        NodeKey<T, Compare> key;
         Node *next;
-        mutex lock;
+        NodeMutex lock;
     };
     Node *head;
     Node *tail;
+    StripedCounter count;
     bool validate(Node *, Node *);
 };
 
 /*************************************************************************
  * Initialize class variables
- * Head and tail will be used as a sentinel nodes
+ * Head and tail will be used as a sentinel nodes, their keys are never read
  * **********************************************************************/
-template <class T>
-OptimisticList<T>::OptimisticList() {
+template <class T, class Compare>
+OptimisticList<T, Compare>::OptimisticList() {
     head = new Node;
-    head->key = {};
 
     tail = new Node;
-    tail->key = {};
     tail->next = NULL;
 
     head->next = tail;
@@ -58,8 +75,8 @@ OptimisticList<T>::OptimisticList() {
 /*************************************************************************
  * Deallocate linked list memory
  * **********************************************************************/
-template <class T>
-OptimisticList<T>::~OptimisticList() {
+template <class T, class Compare>
+OptimisticList<T, Compare>::~OptimisticList() {
     deleteList();
 
     delete head;
@@ -70,8 +87,11 @@ OptimisticList<T>::~OptimisticList() {
  * Uses Optimistic Synchronization to check if the given parameter is in
  * the linked list. If found, return true, else return false.
  * **********************************************************************/
-template <class T>
-bool OptimisticList<T>::contains(T key) {
+template <class T, class Compare>
+bool OptimisticList<T, Compare>::contains(T key) {
+    PROFILE_LOCKS(CONTAINS, key);
+
+    Probe probe(key);
     while (true) {
         Node *pred = head;
         Node *curr = head->next;
@@ -79,7 +99,7 @@ bool OptimisticList<T>::contains(T key) {
         // While not at the of the linked list
         while (curr != tail) {
             // If current key is >= key, break out of traversal
-            if (curr->key >= key)
+            if (curr->key >= probe)
                 break;
 
             // Set pred to curr node
@@ -100,7 +120,7 @@ bool OptimisticList<T>::contains(T key) {
             curr->lock.unlock();
 
             // Return true if key was found
-            return (curr->key == key);
+            return (curr != tail && curr->key == probe);
         }
         // Validation failed, release locks and retry
         pred->lock.unlock();
@@ -114,8 +134,24 @@ bool OptimisticList<T>::contains(T key) {
  * return false. If parameter is not already in the linked list, add node
  * and return true.
  * **********************************************************************/
-template <class T>
-bool OptimisticList<T>::add(T key) {
+template <class T, class Compare>
+bool OptimisticList<T, Compare>::add(T key) {
+    return tryAdd(key, WAIT_FOREVER) == TryResult::SUCCEEDED;
+}
+
+/*************************************************************************
+ * Same as add(), but gives up once the given number of failed lock
+ * attempts and retries is spent, returning BUSY without having changed
+ * the list. The budget covers the whole call, so latency sensitive
+ * callers can shed or defer the update instead of queueing behind a
+ * stalled lock holder. Returns SUCCEEDED or FAILED where add()
+ * would return true or false.
+ * **********************************************************************/
+template <class T, class Compare>
+TryResult OptimisticList<T, Compare>::tryAdd(T key, std::size_t spins) {
+    PROFILE_LOCKS(ADD, key);
+
+    Probe probe(key);
     while (true) {
         Node *pred = head;
         Node *curr = head->next;
@@ -123,7 +159,7 @@ bool OptimisticList<T>::add(T key) {
         // While not at the of the linked list
         while (curr != tail) {
             // If current key is >= key, break out of traversal
-            if (curr->key >= key)
+            if (curr->key >= probe)
                 break;
 
             // Set pred to curr node
@@ -133,17 +169,21 @@ bool OptimisticList<T>::add(T key) {
             curr = curr->next;
         }
 
-        // Acquire pred and curr locks
-        pred->lock.lock();
-        curr->lock.lock();
+        // Acquire pred and curr locks, giving up if either stays busy
+        if (!acquire(pred->lock, spins))
+            return TryResult::BUSY;
+        if (!acquire(curr->lock, spins)) {
+            pred->lock.unlock();
+            return TryResult::BUSY;
+        }
 
         // Validate we locked correct nodes
         if (validate(pred, curr)) {
             // If valid & key is found in list, release locks and return false
-            if (curr != tail && curr->key == key) {
+            if (curr != tail && curr->key == probe) {
                 pred->lock.unlock();
                 curr->lock.unlock();
-                return false;
+                return TryResult::FAILED;
             }
             // Else, add key to list, release locks and return true
             else {
@@ -155,12 +195,15 @@ bool OptimisticList<T>::add(T key) {
                 pred->lock.unlock();
                 curr->lock.unlock();
 
-                return true;
+                count.add(1);
+                return TryResult::SUCCEEDED;
             }
         }
-        // Validation failed, release locks and retry
+        // Validation failed, release locks and retry while budget remains
         pred->lock.unlock();
         curr->lock.unlock();
+        if (!retry(spins))
+            return TryResult::BUSY;
     }
 }
 
@@ -169,8 +212,24 @@ bool OptimisticList<T>::add(T key) {
  * If the parameter is not found in the linked list, return false. If the
  * parameter is found in the linked list, remove it and return true.
  * **********************************************************************/
-template <class T>
-bool OptimisticList<T>::remove(T key) {
+template <class T, class Compare>
+bool OptimisticList<T, Compare>::remove(T key) {
+    return tryRemove(key, WAIT_FOREVER) == TryResult::SUCCEEDED;
+}
+
+/*************************************************************************
+ * Same as remove(), but gives up once the given number of failed lock
+ * attempts and retries is spent, returning BUSY without having changed
+ * the list. The budget covers the whole call, so latency sensitive
+ * callers can shed or defer the update instead of queueing behind a
+ * stalled lock holder. Returns SUCCEEDED or FAILED where remove()
+ * would return true or false.
+ * **********************************************************************/
+template <class T, class Compare>
+TryResult OptimisticList<T, Compare>::tryRemove(T key, std::size_t spins) {
+    PROFILE_LOCKS(REMOVE, key);
+
+    Probe probe(key);
     while (true) {
         Node *pred = head;
         Node *curr = head->next;
@@ -178,7 +237,7 @@ bool OptimisticList<T>::remove(T key) {
         // While not at the of the linked list
         while (curr != tail) {
             // If current key is >= key, break out of traversal
-            if (curr->key >= key)
+            if (curr->key >= probe)
                 break;
 
             // Set pred to curr node
@@ -188,17 +247,21 @@ bool OptimisticList<T>::remove(T key) {
             curr = curr->next;
         }
 
-        // Acquire pred and curr locks
-        pred->lock.lock();
-        curr->lock.lock();
+        // Acquire pred and curr locks, giving up if either stays busy
+        if (!acquire(pred->lock, spins))
+            return TryResult::BUSY;
+        if (!acquire(curr->lock, spins)) {
+            pred->lock.unlock();
+            return TryResult::BUSY;
+        }
 
         // Validate we locked correct nodes
         if (validate(pred, curr)) {
             // If valid & key is not found in list, release locks and return false
-            if (curr != tail && curr->key != key) {
+            if (curr == tail || curr->key != probe) {
                 pred->lock.unlock();
                 curr->lock.unlock();
-                return false;
+                return TryResult::FAILED;
             }
             // Else, remove key from list, release locks and return true
             else {
@@ -208,20 +271,43 @@ bool OptimisticList<T>::remove(T key) {
 
                 pred->lock.unlock();
                 curr->lock.unlock();
-                return true;
+
+                count.add(-1);
+                return TryResult::SUCCEEDED;
             }
         }
-        // Validation failed, release locks and retry
+        // Validation failed, release locks and retry while budget remains
         pred->lock.unlock();
         curr->lock.unlock();
+        if (!retry(spins))
+            return TryResult::BUSY;
     }
 }
 
+/*************************************************************************
+ * Returns the number of keys in the list from per-thread striped counters
+ * updated by successful add() and remove() calls. Cheap, but updates in
+ * flight may or may not be counted.
+ * **********************************************************************/
+template <class T, class Compare>
+std::size_t OptimisticList<T, Compare>::size() const {
+    return count.approximate();
+}
+
+/*************************************************************************
+ * Returns the number of keys in the list. Exact whenever no updates are
+ * in flight; under contention it retries until the counters are stable.
+ * **********************************************************************/
+template <class T, class Compare>
+std::size_t OptimisticList<T, Compare>::sizeExact() const {
+    return count.exact();
+}
+
 /*************************************************************************
  * Display contents of linked list
  * **********************************************************************/
-template <class T>
-void OptimisticList<T>::printList() {
+template <class T, class Compare>
+void OptimisticList<T, Compare>::printList() {
     // Acquire head lock
     head->lock.lock();
 
@@ -241,16 +327,13 @@ void OptimisticList<T>::printList() {
 /*************************************************************************
  * Validation checks that pred points to curr and is reachable from head.
  * **********************************************************************/
-template <class T>
-bool OptimisticList<T>::validate(Node *pred, Node *curr) {
+template <class T, class Compare>
+bool OptimisticList<T, Compare>::validate(Node *pred, Node *curr) {
     // Set node to head
     Node *node = head;
 
     // While not at the of the linked list
     while (node != tail) {
-        // If node key > pred key, incorrect node, break and return false
-        if (node->key > pred->key)
-            break;
         // If pred is reachable from head
         if (node == pred)
             // Return true if pred points to curr, else false
@@ -258,6 +341,11 @@ bool OptimisticList<T>::validate(Node *pred, Node *curr) {
 
         // Update node to next node in list
         node = node->next;
+
+        // If node key > pred key, incorrect node, break and return false.
+        // Head and tail hold no key, so they are never compared.
+        if (node != tail && node->key > pred->key)
+            break;
     }
     return false;
 }
@@ -265,8 +353,8 @@ bool OptimisticList<T>::validate(Node *pred, Node *curr) {
 /*************************************************************************
  * Delete contents of linked list
  * **********************************************************************/
-template <class T>
-void OptimisticList<T>::deleteList() {
+template <class T, class Compare>
+void OptimisticList<T, Compare>::deleteList() {
     Node *temp;
 
     while (head->next != tail) {
@@ -274,12 +362,11 @@ void OptimisticList<T>::deleteList() {
         head->next = temp->next;
         delete temp;
     }
+    count.reset();
 
     head = new Node;
-    head->key = {};
 
     tail = new Node;
-    tail->key = {};
     tail->next = NULL;
 
     head->next = tail;
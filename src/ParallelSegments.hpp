@@ -0,0 +1,35 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <thread>
+#include <vector>
+
+/*
+ * Runs fn(segment) for every segment in [0, segments) on the given number
+ * of threads, the calling thread included. Threads claim the next
+ * unprocessed segment from a shared counter, so a thread that finishes a
+ * short segment immediately picks up more work and long segments do not
+ * hold back the whole run.
+ */
+template <class Function>
+void runSegments(std::size_t threads, std::size_t segments, Function fn) {
+    std::atomic<std::size_t> next(0);
+
+    auto worker = [&]() {
+        std::size_t segment;
+        while ((segment = next.fetch_add(1)) < segments)
+            fn(segment);
+    };
+
+    if (threads > segments)
+        threads = segments;
+
+    std::vector<std::thread> pool;
+    for (std::size_t i = 1; i < threads; i++)
+        pool.emplace_back(worker);
+    worker();
+
+    for (std::thread &thread : pool)
+        thread.join();
+}
@@ -0,0 +1,14 @@
+#pragma once
+
+/*
+ * Hint the processor to start loading the cache line at addr. Traversals
+ * call it on the next node while still comparing the current one, so the
+ * miss on the next hop overlaps with useful work.
+ */
+inline void prefetch(const void *addr) {
+#if defined(__GNUC__) || defined(__clang__)
+    __builtin_prefetch(addr, 0, 3);
+#else
+    (void)addr;
+#endif
+}
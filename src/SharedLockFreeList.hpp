@@ -0,0 +1,604 @@
+/*************************************************************************
+ * Shared-memory Lock-free Linked List
+ *
+ * The lock-free list laid out in a named POSIX shared memory segment, so
+ * several processes on one host can attach to the same set and update it
+ * concurrently. Nodes are linked by their offset from the start of the
+ * segment rather than by address, since every process maps the segment
+ * at a different address. Each link is one 64-bit atomic word holding the
+ * offset shifted left by one with the mark in the low bit, so marking and
+ * snipping are single CAS operations, as with AtomicMarkableReference.
+ *
+ * Nodes come from a bump allocator inside the segment and go back onto a
+ * free stack once no process can still be traversing them. Reclamation is
+ * epoch based and lives in the segment too: every attached instance owns
+ * a slot in the header counting its threads inside an operation, by the
+ * parity of the epoch they entered in. A snipped node is retired onto the
+ * limbo stack of the current epoch, the epoch advances once no thread is
+ * still inside the previous one, and the nodes retired two epochs back
+ * are then free. The capacity therefore bounds the size of the set plus
+ * the nodes awaiting reclamation. A process that dies inside an operation
+ * would stall the epoch, so a slot whose owner has exited is cleared.
+ * Its update either took effect or did not, but size() may be left off
+ * by one. Keys must be trivially copyable.
+ *
+ * **********************************************************************/
+#pragma once
+
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <iostream>
+#include <new>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <type_traits>
+
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+template <class T>
+class SharedLockFreeList {
+    static_assert(std::is_trivially_copyable<T>::value, "keys are copied into shared memory");
+    static_assert(std::atomic<std::uint64_t>::is_always_lock_free, "links must be address-free atomics");
+
+   public:
+    SharedLockFreeList(const std::string &, std::size_t);
+    ~SharedLockFreeList();
+    SharedLockFreeList(const SharedLockFreeList &) = delete;
+    SharedLockFreeList &operator=(const SharedLockFreeList &) = delete;
+    bool contains(T);
+    bool add(T);
+    bool remove(T);
+    std::size_t size() const;
+    void printList();
+    static bool unlink(const std::string &);
+
+   private:
+    typedef std::uint64_t Offset;
+
+    struct Node {
+        T key;
+        std::atomic<std::uint64_t> next;
+        // Next node on a limbo stack
+        Offset retiredNext;
+    };
+
+    // Threads of one attached instance inside an operation, counted by the
+    // parity of the epoch they entered in
+    struct Slot {
+        std::atomic<std::uint32_t> owner;
+        std::atomic<std::uint32_t> inside[2];
+    };
+
+    struct Header {
+        std::uint64_t magic;
+        std::uint64_t nodeBytes;
+        std::atomic<std::uint32_t> ready;
+        std::uint64_t capacity;
+        std::atomic<std::uint64_t> used;
+        // Top of the stack of free nodes, tagged against ABA
+        std::atomic<std::uint64_t> spare;
+        std::atomic<std::int64_t> count;
+        Offset head;
+        Offset tail;
+        std::atomic<std::uint64_t> epoch;
+        // Nodes retired in each epoch modulo 3
+        std::atomic<Offset> limbo[3];
+        // One per attached instance
+        Slot slots[64];
+    };
+
+    // Pins the calling thread to the current epoch for its lifetime
+    class Guard {
+       public:
+        Guard(SharedLockFreeList *myList) : list(myList) {
+            enter();
+        }
+        ~Guard() {
+            leave();
+        }
+        void enter() {
+            parity = list->header->epoch.load() & 1;
+            list->slot->inside[parity].fetch_add(1);
+        }
+        void leave() {
+            list->slot->inside[parity].fetch_sub(1);
+        }
+
+       private:
+        SharedLockFreeList *list;
+        unsigned parity;
+    };
+
+    static const std::uint64_t MAGIC = 0x4c4646534c495333ULL;
+    // The free stack packs a node offset below a version tag
+    static const unsigned TAG_SHIFT = 40;
+    static const std::uint64_t OFFSET_MASK = (std::uint64_t(1) << TAG_SHIFT) - 1;
+    // Owner of a slot whose dead owner's counts are being cleared
+    static const std::uint32_t CLEARING = 0xffffffff;
+    // How long attaching waits for the creator to set the segment up
+    static const int ATTACH_SECONDS = 5;
+    // How many times add() tries to reclaim nodes before giving up
+    static const int COLLECT_TRIES = 100000;
+
+    int fd;
+    std::size_t length;
+    char *base;
+    Header *header;
+    Slot *slot;
+    std::atomic<unsigned> retires;
+
+    Node *node(Offset offset) const {
+        return reinterpret_cast<Node *>(base + offset);
+    }
+
+    static Offset offsetOf(std::uint64_t link) {
+        return link >> 1;
+    }
+
+    static bool markedIn(std::uint64_t link) {
+        return link & 1;
+    }
+
+    static std::uint64_t pack(Offset offset, bool marked) {
+        return offset << 1 | (marked ? 1 : 0);
+    }
+
+    static std::size_t nodeSize() {
+        return (sizeof(Node) + alignof(Node) - 1) / alignof(Node) * alignof(Node);
+    }
+
+    static std::size_t headerSize() {
+        return (sizeof(Header) + alignof(Node) - 1) / alignof(Node) * alignof(Node);
+    }
+
+    Offset allocate(const T &);
+    void release(Offset);
+    void retire(Offset);
+    bool advance();
+    Offset collect(const T &);
+    bool clear(Slot &);
+    void format(std::size_t);
+    void attach(const std::string &);
+    void find(const T &, Offset &, Offset &);
+};
+
+/*
+ * Attach to the segment with the given name, creating it with room for
+ * capacity nodes if it does not exist yet. Processes attaching while the
+ * creator is still setting the segment up wait up to ATTACH_SECONDS for it
+ * to finish. Throws std::system_error if the segment cannot be opened or
+ * mapped, was never set up, or has no free slot for another instance.
+ */
+template <class T>
+SharedLockFreeList<T>::SharedLockFreeList(const std::string &name, std::size_t capacity)
+    : fd(-1), length(0), base(NULL), header(NULL), slot(NULL), retires(0) {
+    bool created = true;
+    std::chrono::steady_clock::time_point deadline =
+        std::chrono::steady_clock::now() + std::chrono::seconds(ATTACH_SECONDS);
+
+    fd = shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+    if (fd == -1 && errno == EEXIST) {
+        created = false;
+        fd = shm_open(name.c_str(), O_RDWR, 0600);
+    }
+    if (fd == -1)
+        throw std::system_error(errno, std::generic_category(), "shm_open " + name);
+
+    if (created) {
+        length = headerSize() + (capacity + 2) * nodeSize();
+        if (length > OFFSET_MASK) {
+            close(fd);
+            shm_unlink(name.c_str());
+            throw std::system_error(EFBIG, std::generic_category(), "shm segment " + name);
+        }
+        if (ftruncate(fd, length) == -1) {
+            int error = errno;
+            close(fd);
+            shm_unlink(name.c_str());
+            throw std::system_error(error, std::generic_category(), "ftruncate " + name);
+        }
+    } else {
+        // Wait for the creator to size the segment
+        struct stat info;
+        do {
+            if (fstat(fd, &info) == -1) {
+                int error = errno;
+                close(fd);
+                throw std::system_error(error, std::generic_category(), "fstat " + name);
+            }
+            if (info.st_size == 0) {
+                if (std::chrono::steady_clock::now() > deadline) {
+                    close(fd);
+                    throw std::system_error(ETIMEDOUT, std::generic_category(), "shm segment " + name);
+                }
+                std::this_thread::yield();
+            }
+        } while (info.st_size == 0);
+        length = info.st_size;
+    }
+
+    void *mapped = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (mapped == MAP_FAILED) {
+        int error = errno;
+        close(fd);
+        throw std::system_error(error, std::generic_category(), "mmap " + name);
+    }
+    base = static_cast<char *>(mapped);
+    header = reinterpret_cast<Header *>(base);
+
+    if (created) {
+        format(capacity);
+    } else {
+        // A creator that died before finishing leaves ready unset for good
+        while (header->ready.load(std::memory_order_acquire) == 0) {
+            if (std::chrono::steady_clock::now() > deadline) {
+                munmap(base, length);
+                close(fd);
+                throw std::system_error(ETIMEDOUT, std::generic_category(), "shm segment " + name);
+            }
+            std::this_thread::yield();
+        }
+    }
+
+    attach(name);
+}
+
+/*
+ * Detach from the segment. The segment and the set it holds persist until
+ * unlink() is called and every process has detached.
+ */
+template <class T>
+SharedLockFreeList<T>::~SharedLockFreeList() {
+    slot->owner.store(0);
+    munmap(base, length);
+    close(fd);
+}
+
+/*
+ * Check if the given parameter is in the set without modifying it
+ */
+template <class T>
+bool SharedLockFreeList<T>::contains(T key) {
+    Guard guard(this);
+    Offset curr = offsetOf(node(header->head)->next.load());
+    while (curr != header->tail && node(curr)->key < key)
+        curr = offsetOf(node(curr)->next.load());
+    return curr != header->tail && node(curr)->key == key && !markedIn(node(curr)->next.load());
+}
+
+/*
+ * Add the given parameter to the set. Returns false if it was already
+ * present. Throws std::bad_alloc once the segment has run out of nodes
+ * and none can be reclaimed. The node is taken only once the key is known
+ * to be absent and kept across retries; if a retry finds the key after
+ * all it is released.
+ */
+template <class T>
+bool SharedLockFreeList<T>::add(T key) {
+    Guard guard(this);
+    Offset fresh = 0;
+
+    while (true) {
+        Offset pred, curr;
+        find(key, pred, curr);
+
+        if (curr != header->tail && node(curr)->key == key) {
+            if (fresh != 0)
+                release(fresh);
+            return false;
+        }
+
+        if (fresh == 0) {
+            fresh = allocate(key);
+            if (fresh == 0) {
+                // Step out of the epoch so it can advance past this thread,
+                // then search again since pred and curr may have been freed
+                guard.leave();
+                fresh = collect(key);
+                guard.enter();
+                if (fresh == 0)
+                    throw std::bad_alloc();
+                continue;
+            }
+        }
+        node(fresh)->next.store(pack(curr, false), std::memory_order_relaxed);
+
+        std::uint64_t expected = pack(curr, false);
+        if (node(pred)->next.compare_exchange_strong(expected, pack(fresh, false))) {
+            header->count.fetch_add(1, std::memory_order_relaxed);
+            return true;
+        }
+    }
+}
+
+/*
+ * Remove the given parameter from the set. Returns false if it was not
+ * present.
+ */
+template <class T>
+bool SharedLockFreeList<T>::remove(T key) {
+    Guard guard(this);
+
+    while (true) {
+        Offset pred, curr;
+        find(key, pred, curr);
+
+        if (curr == header->tail || !(node(curr)->key == key))
+            return false;
+
+        // Logical removal
+        std::uint64_t succ = node(curr)->next.load();
+        if (markedIn(succ))
+            continue;
+        if (!node(curr)->next.compare_exchange_strong(succ, succ | 1))
+            continue;
+        header->count.fetch_sub(1, std::memory_order_relaxed);
+
+        // Physical removal, left to later traversals if pred has changed
+        std::uint64_t expected = pack(curr, false);
+        if (node(pred)->next.compare_exchange_strong(expected, pack(offsetOf(succ), false)))
+            retire(curr);
+        return true;
+    }
+}
+
+template <class T>
+std::size_t SharedLockFreeList<T>::size() const {
+    std::int64_t count = header->count.load(std::memory_order_relaxed);
+    return count > 0 ? count : 0;
+}
+
+template <class T>
+void SharedLockFreeList<T>::printList() {
+    Guard guard(this);
+    Offset curr = offsetOf(node(header->head)->next.load());
+    while (curr != header->tail) {
+        if (!markedIn(node(curr)->next.load()))
+            std::cout << node(curr)->key << " ";
+        curr = offsetOf(node(curr)->next.load());
+    }
+    std::cout << std::endl;
+}
+
+/*
+ * Remove the segment name, so the next process to attach creates a fresh
+ * set. Processes already attached keep using the old one.
+ */
+template <class T>
+bool SharedLockFreeList<T>::unlink(const std::string &name) {
+    return shm_unlink(name.c_str()) == 0;
+}
+
+/*
+ * Take a node from the segment for the given key, preferring a free one
+ * over a new one. Returns 0 once the segment has run out of nodes.
+ */
+template <class T>
+typename SharedLockFreeList<T>::Offset SharedLockFreeList<T>::allocate(const T &key) {
+    std::uint64_t top = header->spare.load();
+    while ((top & OFFSET_MASK) != 0) {
+        Offset offset = top & OFFSET_MASK;
+        // The tag changes on every pop, so a node popped and released again
+        // in the meantime fails the CAS instead of corrupting the stack
+        std::uint64_t below = node(offset)->next.load(std::memory_order_relaxed);
+        std::uint64_t popped = ((top >> TAG_SHIFT) + 1) << TAG_SHIFT | below;
+        if (header->spare.compare_exchange_weak(top, popped)) {
+            node(offset)->key = key;
+            return offset;
+        }
+    }
+
+    std::uint64_t index = header->used.load(std::memory_order_relaxed);
+    do {
+        if (index >= header->capacity + 2)
+            return 0;
+    } while (!header->used.compare_exchange_weak(index, index + 1, std::memory_order_relaxed));
+
+    Offset offset = headerSize() + index * nodeSize();
+    Node *fresh = new (base + offset) Node;
+    fresh->key = key;
+    return offset;
+}
+
+/*
+ * Push a node no process can reach onto the free stack. Its next field
+ * holds the offset of the node below it.
+ */
+template <class T>
+void SharedLockFreeList<T>::release(Offset offset) {
+    std::uint64_t top = header->spare.load();
+    do {
+        node(offset)->next.store(top & OFFSET_MASK, std::memory_order_relaxed);
+    } while (!header->spare.compare_exchange_weak(top, (top & ~OFFSET_MASK) | offset));
+}
+
+/*
+ * Push a node the caller snipped onto the limbo stack of the current
+ * epoch. The caller is inside an operation, so the epoch cannot move two
+ * steps past the one read here before the push lands. Every 64 retires
+ * the epoch is moved on, if it can be, to keep the free stack stocked.
+ */
+template <class T>
+void SharedLockFreeList<T>::retire(Offset offset) {
+    std::atomic<Offset> &limbo = header->limbo[header->epoch.load() % 3];
+    Offset top = limbo.load();
+    do {
+        node(offset)->retiredNext = top;
+    } while (!limbo.compare_exchange_weak(top, offset));
+
+    if (retires.fetch_add(1, std::memory_order_relaxed) % 64 == 63)
+        advance();
+}
+
+/*
+ * Move the epoch on by one if no thread is still inside the previous
+ * one, and free the nodes retired two epochs back, which no operation can
+ * reach any more. Slots of processes that have exited are cleared on the
+ * way. Returns false if some thread held the epoch back.
+ */
+template <class T>
+bool SharedLockFreeList<T>::advance() {
+    std::uint64_t epoch = header->epoch.load();
+    unsigned previous = (epoch + 1) & 1;
+
+    for (Slot &other : header->slots)
+        if (other.inside[previous].load() != 0 && !clear(other))
+            return false;
+
+    if (!header->epoch.compare_exchange_strong(epoch, epoch + 1))
+        return false;
+
+    Offset curr = header->limbo[(epoch + 2) % 3].exchange(0);
+    while (curr != 0) {
+        Offset next = node(curr)->retiredNext;
+        release(curr);
+        curr = next;
+    }
+    return true;
+}
+
+/*
+ * Take a node for the given key once the segment has run out, moving the
+ * epoch on until retired nodes come free. Called outside any operation.
+ * Gives up, returning 0, when nothing is awaiting reclamation or other
+ * threads hold the epoch back for COLLECT_TRIES attempts.
+ */
+template <class T>
+typename SharedLockFreeList<T>::Offset SharedLockFreeList<T>::collect(const T &key) {
+    for (int i = 0; i < COLLECT_TRIES; i++) {
+        Offset offset = allocate(key);
+        if (offset != 0)
+            return offset;
+
+        bool waiting = false;
+        for (std::atomic<Offset> &limbo : header->limbo)
+            waiting = waiting || limbo.load() != 0;
+        if (!waiting)
+            return 0;
+
+        if (!advance())
+            std::this_thread::yield();
+    }
+    return 0;
+}
+
+/*
+ * Free a slot whose owner process has exited, dropping the counts it left
+ * behind. Returns false if the owner is still running, or is a zombie not
+ * yet reaped; a reused pid only keeps the slot from being cleared.
+ */
+template <class T>
+bool SharedLockFreeList<T>::clear(Slot &other) {
+    std::uint32_t owner = other.owner.load();
+    if (owner == 0 || owner == CLEARING)
+        return true;
+    if (kill(owner, 0) == 0 || errno != ESRCH)
+        return false;
+    if (other.owner.compare_exchange_strong(owner, CLEARING)) {
+        other.inside[0].store(0);
+        other.inside[1].store(0);
+        other.owner.store(0);
+    }
+    return true;
+}
+
+/*
+ * Lay out the header and the head and tail sentinels of a new segment.
+ * The tail is recognized by its offset, so neither sentinel needs a key.
+ */
+template <class T>
+void SharedLockFreeList<T>::format(std::size_t capacity) {
+    new (header) Header;
+    header->magic = MAGIC;
+    header->nodeBytes = nodeSize();
+    header->capacity = capacity;
+    header->used.store(0, std::memory_order_relaxed);
+    header->spare.store(0, std::memory_order_relaxed);
+    header->count.store(0, std::memory_order_relaxed);
+    header->epoch.store(0, std::memory_order_relaxed);
+    for (std::atomic<Offset> &limbo : header->limbo)
+        limbo.store(0, std::memory_order_relaxed);
+    for (Slot &other : header->slots) {
+        other.owner.store(0, std::memory_order_relaxed);
+        other.inside[0].store(0, std::memory_order_relaxed);
+        other.inside[1].store(0, std::memory_order_relaxed);
+    }
+
+    header->head = allocate(T());
+    header->tail = allocate(T());
+    node(header->tail)->next.store(pack(0, false), std::memory_order_relaxed);
+    node(header->head)->next.store(pack(header->tail, false), std::memory_order_relaxed);
+
+    header->ready.store(1, std::memory_order_release);
+}
+
+/*
+ * Check the segment holds this kind of list and claim a slot for this
+ * instance, clearing slots of processes that have exited if none is free
+ */
+template <class T>
+void SharedLockFreeList<T>::attach(const std::string &name) {
+    // Refuse segments holding a different kind of list or key type
+    int error = EINVAL;
+    if (header->magic == MAGIC && header->nodeBytes == nodeSize()) {
+        error = EBUSY;
+        for (int pass = 0; pass < 2 && slot == NULL; pass++) {
+            for (Slot &other : header->slots) {
+                std::uint32_t owner = 0;
+                if (pass == 1)
+                    clear(other);
+                if (other.owner.compare_exchange_strong(owner, getpid())) {
+                    slot = &other;
+                    break;
+                }
+            }
+        }
+    }
+
+    if (slot == NULL) {
+        munmap(base, length);
+        close(fd);
+        throw std::system_error(error, std::generic_category(), "shm segment " + name);
+    }
+}
+
+/*
+ * Set pred and curr to the nodes on either side of key, snipping marked
+ * nodes on the way, like LockFreeList's Window
+ */
+template <class T>
+void SharedLockFreeList<T>::find(const T &key, Offset &pred, Offset &curr) {
+RETRY:
+    while (true) {
+        pred = header->head;
+        curr = offsetOf(node(pred)->next.load());
+        while (true) {
+            if (curr == header->tail)
+                return;
+
+            std::uint64_t succ = node(curr)->next.load();
+            while (markedIn(succ)) {
+                std::uint64_t expected = pack(curr, false);
+                if (!node(pred)->next.compare_exchange_strong(expected, pack(offsetOf(succ), false)))
+                    goto RETRY;
+                retire(curr);
+                curr = offsetOf(succ);
+                if (curr == header->tail)
+                    return;
+                succ = node(curr)->next.load();
+            }
+
+            if (!(node(curr)->key < key))
+                return;
+            pred = curr;
+            curr = offsetOf(succ);
+        }
+    }
+}
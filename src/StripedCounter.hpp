@@ -0,0 +1,65 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+
+/*
+ * A counter split into cache-line sized stripes. Each thread updates the
+ * stripe it was assigned on first use, so concurrent updates from
+ * different threads do not contend on a single shared word. Reading the
+ * value sums every stripe.
+ */
+class StripedCounter {
+   private:
+    static const std::size_t STRIPES = 64;
+
+    struct alignas(64) Stripe {
+        std::atomic<long> value;
+        Stripe() : value(0) {}
+    };
+    Stripe stripes[STRIPES];
+
+    // Threads are assigned stripes round-robin the first time they update
+    // any counter
+    static std::size_t stripe() {
+        static std::atomic<std::size_t> next(0);
+        thread_local std::size_t index = next.fetch_add(1, std::memory_order_relaxed) % STRIPES;
+        return index;
+    }
+
+    long collect(std::memory_order order) const {
+        long sum = 0;
+        for (std::size_t i = 0; i < STRIPES; i++)
+            sum += stripes[i].value.load(order);
+        return sum;
+    }
+
+   public:
+    void add(long delta) {
+        stripes[stripe()].value.fetch_add(delta, std::memory_order_relaxed);
+    }
+
+    // Sum of the stripes without any synchronization. Updates racing with
+    // the read may or may not be counted.
+    std::size_t approximate() const {
+        long sum = collect(std::memory_order_relaxed);
+        return sum > 0 ? sum : 0;
+    }
+
+    // Collect the stripes until two consecutive collects agree. When no
+    // updates are in flight this is the exact count.
+    std::size_t exact() const {
+        long prev = collect(std::memory_order_acquire);
+        while (true) {
+            long sum = collect(std::memory_order_acquire);
+            if (sum == prev)
+                return sum > 0 ? sum : 0;
+            prev = sum;
+        }
+    }
+
+    void reset() {
+        for (std::size_t i = 0; i < STRIPES; i++)
+            stripes[i].value.store(0, std::memory_order_relaxed);
+    }
+};
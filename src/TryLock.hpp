@@ -0,0 +1,50 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <thread>
+
+/*
+ * Outcome of an update that may give up on a busy lock instead of waiting
+ * for it
+ */
+enum class TryResult { SUCCEEDED, FAILED, BUSY };
+
+// Spin budget that makes acquire() block like lock()
+const std::size_t WAIT_FOREVER = SIZE_MAX;
+
+/*
+ * Acquires the mutex, giving up once the spin budget is spent. Every failed
+ * try_lock() takes one spin from the budget, so an operation that passes
+ * the same budget to all its acquisitions is bounded as a whole rather
+ * than per lock. Yields between attempts so a preempted holder can run.
+ */
+template <class Mutex>
+bool acquire(Mutex &mutex, std::size_t &spins) {
+    if (spins == WAIT_FOREVER) {
+        mutex.lock();
+        return true;
+    }
+
+    while (true) {
+        if (mutex.try_lock())
+            return true;
+        if (spins == 0)
+            return false;
+        spins--;
+        std::this_thread::yield();
+    }
+}
+
+/*
+ * Takes one spin from the budget for an operation about to restart after
+ * a failed validation. Returns false once the budget is spent.
+ */
+inline bool retry(std::size_t &spins) {
+    if (spins == WAIT_FOREVER)
+        return true;
+    if (spins == 0)
+        return false;
+    spins--;
+    return true;
+}
@@ -0,0 +1,112 @@
+#include <atomic>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+#include "AdaptiveSet.hpp"
+#include "Check.hpp"
+
+/*************************************************************************
+ * Concurrent updates on disjoint keys while the table grows leave exactly
+ * the keys expected.
+ * **********************************************************************/
+void updates() {
+    const int T = 4, N = 20000;
+    AdaptiveSet<long> set;
+    atomic<long> wrong(0);
+    vector<thread> threads;
+    for (int t = 0; t < T; t++) {
+        threads.emplace_back([&, t] {
+            for (long i = 0; i < N; i++) {
+                long key = t * N + i;
+                if (!set.add(key))
+                    wrong++;
+                if (i % 3 == 0 && !set.remove(key))
+                    wrong++;
+                if (set.contains(key) != (i % 3 != 0))
+                    wrong++;
+            }
+        });
+    }
+    for (auto &t : threads)
+        t.join();
+
+    CHECK(wrong == 0);
+    CHECK(set.buckets() > 1);
+    for (long key = 0; key < T * N; key++)
+        CHECK(set.contains(key) == (key % N % 3 != 0));
+    CHECK(!set.add(1) && set.add(-5) && set.remove(-5) && !set.remove(-5));
+    set.reclaim();
+
+    AdaptiveSet<string> words;
+    words.add("a");
+    words.add("b");
+    CHECK(words.contains("a") && !words.contains("c") && words.size() == 2);
+}
+
+/*************************************************************************
+ * Growing and shrinking over and over keeps the stable keys visible to a
+ * concurrent reader, and the table shrinks back once the keys are gone.
+ * **********************************************************************/
+void growAndShrink() {
+    const long STABLE = 200;
+    AdaptiveSet<long> set;
+    for (long i = 0; i < STABLE; i++)
+        set.add(-1 - i);
+
+    atomic<bool> stop(false);
+    atomic<long> wrong(0);
+    thread reader([&] {
+        while (!stop)
+            for (long i = 0; i < STABLE; i++)
+                if (!set.contains(-1 - i))
+                    wrong++;
+    });
+
+    for (int round = 0; round < 4; round++) {
+        vector<thread> threads;
+        for (int t = 0; t < 4; t++) {
+            threads.emplace_back([&, t] {
+                for (long i = t; i < 40000; i += 4)
+                    if (!set.add(i))
+                        wrong++;
+            });
+        }
+        for (auto &t : threads)
+            t.join();
+        size_t grown = set.buckets();
+
+        threads.clear();
+        for (int t = 0; t < 4; t++) {
+            threads.emplace_back([&, t] {
+                for (long i = t; i < 40000; i += 4)
+                    if (!set.remove(i))
+                        wrong++;
+            });
+        }
+        for (auto &t : threads)
+            t.join();
+
+        // Updates while small keep resizing running
+        for (int k = 0; k < 20000; k++) {
+            set.add(1000000 + k % 50);
+            set.remove(1000000 + k % 50);
+        }
+        CHECK(set.buckets() < grown);
+    }
+    stop = true;
+    reader.join();
+
+    CHECK(wrong == 0);
+    CHECK(set.size() == STABLE);
+    set.reclaim();
+}
+
+int main() {
+    updates();
+    growAndShrink();
+    return failures() != 0;
+}
@@ -0,0 +1,86 @@
+#include <iostream>
+#include <sstream>
+#include <string>
+
+using namespace std;
+
+#include "BenchmarkStats.hpp"
+#include "Check.hpp"
+
+// True if value lies within the histogram's 1/64 precision of expected
+bool near(uint64_t value, uint64_t expected) {
+    uint64_t error = value > expected ? value - expected : expected - value;
+    return error * 64 <= expected;
+}
+
+/*************************************************************************
+ * Percentiles land within the bucket precision of the true values, and
+ * merge() and reset() combine and clear histograms.
+ * **********************************************************************/
+void histogram() {
+    LatencyHistogram empty;
+    CHECK(empty.count() == 0 && empty.percentile(50) == 0 && empty.max() == 0);
+
+    LatencyHistogram small;
+    for (uint64_t i = 1; i <= 100; i++)
+        small.record(i);
+    CHECK(small.percentile(50) == 50 && small.percentile(99) == 99 && small.max() == 100);
+
+    LatencyHistogram large;
+    for (uint64_t i = 1; i <= 100000; i++)
+        large.record(i * 1000);
+    CHECK(near(large.percentile(50), 50000000));
+    CHECK(near(large.percentile(99), 99000000));
+    CHECK(near(large.percentile(99.9), 99900000));
+    CHECK(large.percentile(100) == 100000000 && large.max() == 100000000);
+
+    LatencyHistogram huge;
+    huge.record(UINT64_MAX);
+    CHECK(huge.percentile(50) == UINT64_MAX);
+
+    small.merge(large);
+    CHECK(small.count() == 100100 && small.max() == 100000000);
+    small.reset();
+    CHECK(small.count() == 0 && small.max() == 0);
+}
+
+/*************************************************************************
+ * A run is written as one CSV row under the header, with an empty field
+ * for every counter that was not available.
+ * **********************************************************************/
+void record() {
+    BenchmarkRecord run("LazyList", 4);
+    run.operations = 1000;
+    run.seconds = 2;
+    for (uint64_t i = 1; i <= 1000; i++)
+        run.latency.record(i);
+
+    PerfCounters counters;
+    counters.start();
+    counters.stop();
+    run.setCounters(counters);
+    CHECK(run.throughput() == 500);
+
+    stringstream header, row;
+    BenchmarkRecord::writeCsvHeader(header);
+    run.writeCsv(row);
+    CHECK(row.str().rfind("LazyList,4,1000,2,500,", 0) == 0);
+
+    size_t columns = 0, fields = 0;
+    for (char c : header.str())
+        columns += c == ',';
+    for (char c : row.str())
+        fields += c == ',';
+    CHECK(columns == fields);
+
+    for (int i = 0; i < PerfCounters::COUNTERS; i++) {
+        PerfCounters::Counter counter = static_cast<PerfCounters::Counter>(i);
+        CHECK(counters.available(counter) == (run.perOperation[i] >= 0));
+    }
+}
+
+int main() {
+    histogram();
+    record();
+    return failures() != 0;
+}
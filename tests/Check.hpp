@@ -0,0 +1,26 @@
+/*************************************************************************
+ * Minimal checks shared by the tests. A failed CHECK reports where it
+ * failed and the test carries on, so one run shows every failure; main()
+ * returns failures() != 0 so ctest sees the result.
+ * **********************************************************************/
+#pragma once
+
+#include <atomic>
+#include <iostream>
+
+inline std::atomic<long> &failedChecks() {
+    static std::atomic<long> failed(0);
+    return failed;
+}
+
+inline long failures() {
+    return failedChecks().load();
+}
+
+#define CHECK(condition)                                                                       \
+    do {                                                                                       \
+        if (!(condition)) {                                                                    \
+            failedChecks()++;                                                                  \
+            std::cerr << __FILE__ << ":" << __LINE__ << ": CHECK(" #condition ") failed" << std::endl; \
+        }                                                                                      \
+    } while (0)
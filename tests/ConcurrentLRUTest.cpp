@@ -0,0 +1,105 @@
+#include <atomic>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+#include "Check.hpp"
+#include "ConcurrentLRU.hpp"
+
+/*************************************************************************
+ * put() updates or inserts, erase() removes, and the least recently used
+ * entry is evicted once enough hits were applied.
+ * **********************************************************************/
+void basics() {
+    ConcurrentLRU<int, string> cache(3);
+    cache.put(1, "a");
+    cache.put(2, "b");
+    cache.put(3, "c");
+    cache.put(3, "C");
+
+    string value;
+    CHECK(cache.get(3, value) && value == "C");
+    CHECK(cache.size() == 3);
+
+    // Enough hits to fill a buffer, so they are applied before the eviction
+    for (int i = 0; i < 70; i++)
+        cache.get(1, value);
+    cache.put(4, "d");
+    CHECK(cache.size() == 3);
+    CHECK(cache.get(1, value) && value == "a");
+    CHECK(!cache.get(2, value));
+    CHECK(cache.get(4, value) && value == "d");
+
+    CHECK(cache.erase(4) && !cache.erase(4) && !cache.get(4, value));
+    CHECK(cache.size() == 2);
+}
+
+/*************************************************************************
+ * Keys hit over and over by every thread survive a steady stream of new
+ * keys, which needs the hits to keep reaching the recency list.
+ * **********************************************************************/
+void hotKeysSurvive() {
+    // The hot keys go in last, so they start out most recently used
+    ConcurrentLRU<int, int> cache(100);
+    for (int i = 99; i >= 0; i--)
+        cache.put(i, i);
+
+    vector<thread> threads;
+    for (int t = 0; t < 8; t++) {
+        threads.emplace_back([&, t] {
+            int value;
+            for (int i = 0; i < 100000; i++) {
+                cache.get(i % 10, value);
+                if (i % 97 == 0)
+                    cache.put(1000 + t * 100000 + i, 0);
+            }
+        });
+    }
+    for (auto &t : threads)
+        t.join();
+
+    int value, hot = 0;
+    for (int i = 0; i < 10; i++)
+        hot += cache.get(i, value);
+    CHECK(hot == 10);
+    CHECK(cache.size() <= 100);
+}
+
+/*************************************************************************
+ * Concurrent gets, puts and erases never return a wrong value or let the
+ * cache grow past its capacity.
+ * **********************************************************************/
+void mixed() {
+    ConcurrentLRU<int, int> cache(1000);
+    atomic<long> wrong(0);
+    vector<thread> threads;
+    for (int t = 0; t < 4; t++) {
+        threads.emplace_back([&, t] {
+            int value;
+            for (int i = 0; i < 100000; i++) {
+                int key = (i * 7 + t) % 3000;
+                if (!cache.get(key, value))
+                    cache.put(key, key);
+                else if (value != key)
+                    wrong++;
+                if (i % 100 == 0)
+                    cache.erase(key);
+            }
+        });
+    }
+    for (auto &t : threads)
+        t.join();
+
+    CHECK(wrong == 0);
+    CHECK(cache.size() <= 1000);
+}
+
+int main() {
+    basics();
+    hotKeysSurvive();
+    mixed();
+    return failures() != 0;
+}
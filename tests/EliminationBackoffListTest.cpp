@@ -0,0 +1,101 @@
+#include <algorithm>
+#include <iostream>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+#include "Check.hpp"
+#include "CoarseGrainedList.hpp"
+#include "EliminationBackoffList.hpp"
+#include "FineGrainedList.hpp"
+
+/*************************************************************************
+ * Without contention the list is a plain stack.
+ * **********************************************************************/
+template <class List>
+void stack() {
+    EliminationBackoffList<long, List> list;
+    for (long i = 1; i <= 100; i++)
+        list.push_back(i);
+    CHECK(list.size() == 100 && !list.empty());
+
+    long value;
+    for (long i = 100; i >= 1; i--)
+        CHECK(list.pop_back(value) && value == i);
+    CHECK(!list.pop_back(value) && list.empty());
+}
+
+/*************************************************************************
+ * Pushes and pops from many threads, whether they meet in the
+ * elimination array or go to the list, hand out every value exactly once.
+ * **********************************************************************/
+template <class List>
+void pushAndPop(int threads) {
+    const int PER_THREAD = 20000;
+    EliminationBackoffList<long, List> list;
+    vector<vector<long>> popped(threads);
+    vector<thread> workers;
+    for (int t = 0; t < threads; t++) {
+        workers.emplace_back([&, t] {
+            for (int i = 0; i < PER_THREAD; i++) {
+                list.push_back((long)t * PER_THREAD + i + 1);
+                long value;
+                if (list.pop_back(value))
+                    popped[t].push_back(value);
+            }
+        });
+    }
+    for (auto &t : workers)
+        t.join();
+
+    vector<long> all;
+    for (auto &values : popped)
+        all.insert(all.end(), values.begin(), values.end());
+    long value;
+    while (list.pop_back(value))
+        all.push_back(value);
+    sort(all.begin(), all.end());
+
+    CHECK((long)all.size() == (long)threads * PER_THREAD);
+    long wrong = 0;
+    for (long i = 0; i < (long)all.size(); i++)
+        wrong += all[i] != i + 1;
+    CHECK(wrong == 0);
+    CHECK(list.empty());
+}
+
+/*************************************************************************
+ * The lists underneath keep both ends in place.
+ * **********************************************************************/
+void lists() {
+    FineGrainedList<int> fine;
+    fine.push_back(1);
+    fine.push_back(2);
+    CHECK(fine.front() == 1 && fine.back() == 2 && fine.size() == 2);
+    fine.pop_back();
+    CHECK(fine.back() == 1);
+
+    int value;
+    CHECK(fine.try_pop_back(value) == TryResult::SUCCEEDED && value == 1);
+    CHECK(fine.try_pop_back(value) == TryResult::FAILED && fine.empty());
+
+    CoarseGrainedList<int> coarse;
+    coarse.push_back(3);
+    coarse.push_back(4);
+    coarse.pop_back();
+    CHECK(coarse.back() == 3 && coarse.size() == 1);
+    CHECK(coarse.try_push_back(5) == TryResult::SUCCEEDED && coarse.back() == 5);
+}
+
+int main() {
+    stack<CoarseGrainedList<long>>();
+    stack<FineGrainedList<long>>();
+    for (int threads : {1, 4, 8}) {
+        pushAndPop<CoarseGrainedList<long>>(threads);
+        pushAndPop<FineGrainedList<long>>(threads);
+    }
+    lists();
+    return failures() != 0;
+}
@@ -0,0 +1,108 @@
+#include <cstdio>
+#include <functional>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <vector>
+
+#include <unistd.h>
+
+using namespace std;
+
+#include "Check.hpp"
+#include "FrozenSet.hpp"
+#include "LazyList.hpp"
+#include "LockFreeList.hpp"
+
+/*************************************************************************
+ * Both layouts find exactly the frozen keys, for sizes that do and do
+ * not fill the last level of the search tree.
+ * **********************************************************************/
+void layouts() {
+    for (int n : {0, 1, 2, 7, 8, 1000, 1023}) {
+        vector<int> keys;
+        for (int i = 0; i < n; i++)
+            keys.push_back(3 * i);
+
+        for (auto layout : {FrozenSet<int>::SORTED, FrozenSet<int>::EYTZINGER}) {
+            FrozenSet<int> set(keys, layout);
+            CHECK(set.size() == (size_t)n && set.layout() == layout);
+            long wrong = 0;
+            for (int key = -3; key < 3 * n + 3; key++)
+                wrong += set.contains(key) != (key >= 0 && key < 3 * n && key % 3 == 0);
+            CHECK(wrong == 0);
+        }
+    }
+
+    FrozenSet<string> words(vector<string>{"apple", "banana", "cherry"}, FrozenSet<string>::EYTZINGER);
+    CHECK(words.contains("banana") && !words.contains("bananas"));
+
+    FrozenSet<int, greater<int>> descending(vector<int>{9, 5, 1});
+    CHECK(descending.contains(5) && !descending.contains(4));
+}
+
+/*************************************************************************
+ * freeze() takes a snapshot of a list, and the snapshot is unaffected by
+ * later updates.
+ * **********************************************************************/
+void freeze() {
+    LazyList<int> lazy;
+    LockFreeList<int> lockFree;
+    for (int i = 0; i < 500; i++) {
+        lazy.add(2 * i);
+        lockFree.add(2 * i);
+    }
+
+    FrozenSet<int> lazySet = lazy.freeze(FrozenSet<int>::EYTZINGER);
+    FrozenSet<int> lockFreeSet = lockFree.freeze();
+    lazy.remove(0);
+    lockFree.remove(0);
+
+    CHECK(lazySet.size() == 500 && lockFreeSet.size() == 500);
+    for (int i = 0; i < 1000; i++) {
+        CHECK(lazySet.contains(i) == (i % 2 == 0));
+        CHECK(lockFreeSet.contains(i) == (i % 2 == 0));
+    }
+}
+
+/*************************************************************************
+ * A saved set maps back with the same keys, and a file saved for another
+ * key type is refused.
+ * **********************************************************************/
+void saveAndLoad() {
+    const string path = "FrozenSetTest-" + to_string(getpid()) + ".bin";
+    vector<long> keys;
+    for (long i = 0; i < 10000; i++)
+        keys.push_back(i * 7);
+
+    FrozenSet<long>(keys, FrozenSet<long>::EYTZINGER).save(path);
+    {
+        FrozenSet<long> loaded = FrozenSet<long>::load(path);
+        CHECK(loaded.size() == keys.size() && loaded.layout() == FrozenSet<long>::EYTZINGER);
+        long wrong = 0;
+        for (long key = 0; key < 70000; key++)
+            wrong += loaded.contains(key) != (key % 7 == 0);
+        CHECK(wrong == 0);
+
+        FrozenSet<long> moved(std::move(loaded));
+        CHECK(moved.contains(7) && !moved.contains(8));
+    }
+
+    bool threw = false;
+    try {
+        FrozenSet<char>::load(path);
+    } catch (system_error &) {
+        threw = true;
+    }
+    CHECK(threw);
+    remove(path.c_str());
+}
+
+int main() {
+    layouts();
+    freeze();
+    saveAndLoad();
+    return failures() != 0;
+}
@@ -0,0 +1,376 @@
+#include <atomic>
+#include <climits>
+#include <functional>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+#include "Check.hpp"
+#include "LazyList.hpp"
+
+/*************************************************************************
+ * Bulk construction keeps one node per key, and clear() and assign()
+ * leave only the new keys behind.
+ * **********************************************************************/
+void bulkConstruction() {
+    vector<int> keys;
+    for (int i = 1; i <= 1000; i++) {
+        keys.push_back(i);
+        keys.push_back(i);
+    }
+
+    LazyList<int> list(keys.begin(), keys.end());
+    CHECK(list.sizeExact() == 1000);
+    CHECK(list.contains(500) && !list.contains(1001));
+
+    list.clear();
+    CHECK(!list.contains(5) && list.sizeExact() == 0);
+
+    list.assign(keys.begin() + 200, keys.end());
+    CHECK(!list.contains(50) && list.contains(700) && list.sizeExact() == 900);
+    CHECK(list.add(2000) && list.remove(700) && !list.contains(700));
+    list.reclaim();
+}
+
+/*************************************************************************
+ * Keys added before clear() returns never survive it, even when updates
+ * race with the clear.
+ * **********************************************************************/
+void clearDuringUpdates() {
+    LazyList<int> list;
+    atomic<bool> stop(false);
+    thread updater([&] {
+        for (int r = 0; !stop; r++) {
+            list.add(r % 5000);
+            list.remove((r + 2500) % 5000);
+        }
+    });
+    for (int r = 0; r < 200; r++) {
+        for (int i = 10000; i < 10100; i++)
+            list.add(i);
+        list.clear();
+        for (int i = 10000; i < 10100; i++)
+            CHECK(!list.contains(i));
+    }
+    stop = true;
+    updater.join();
+    list.reclaim();
+}
+
+/*************************************************************************
+ * size() and sizeExact() agree with the keys left after concurrent
+ * updates.
+ * **********************************************************************/
+void sizes() {
+    LazyList<int> list;
+    vector<thread> threads;
+    for (int t = 0; t < 4; t++) {
+        threads.emplace_back([&, t] {
+            for (int i = 0; i < 2000; i++) {
+                list.add(t * 10000 + i + 1);
+                if (i % 2)
+                    list.remove(t * 10000 + i);
+            }
+        });
+    }
+    for (auto &t : threads)
+        t.join();
+
+    // Each thread removes every odd key it added
+    CHECK(list.sizeExact() == 4 * 1000);
+    CHECK(list.size() == 4 * 1000);
+}
+
+/*************************************************************************
+ * Parallel walks visit every stable key exactly once while compact()
+ * relocates the nodes under them.
+ * **********************************************************************/
+void walksDuringCompaction() {
+    const int N = 20000;
+    LazyList<int> list;
+    for (int i = 0; i < N; i++)
+        list.add(2 * i);
+    list.enableIndex(64);
+
+    atomic<bool> stop(false);
+    thread churn([&] {
+        while (!stop)
+            for (int i = 0; i < N; i += 97) {
+                list.add(2 * i + 1);
+                list.remove(2 * i + 1);
+            }
+    });
+    // Churn between the passes so every compaction has nodes to move
+    thread compactor([&] {
+        while (!stop) {
+            list.compact();
+            for (int i = 0; i < N; i += 13) {
+                list.add(2 * i + 1);
+                list.remove(2 * i + 1);
+            }
+        }
+    });
+
+    for (int r = 0; r < 100; r++) {
+        vector<atomic<int>> seen(N);
+        list.parallelForEach(4, [&](int key) {
+            if (key % 2 == 0)
+                seen[key / 2]++;
+        });
+        long wrong = 0;
+        for (int i = 0; i < N; i++)
+            wrong += seen[i] != 1;
+        CHECK(wrong == 0);
+    }
+    stop = true;
+    churn.join();
+    compactor.join();
+
+    long missing = 0;
+    for (int i = 0; i < N; i++)
+        missing += !list.contains(2 * i);
+    CHECK(missing == 0);
+
+    long sum = list.parallelReduce(
+        4, 0L, [](long total, int key) { return total + key; }, [](long a, long b) { return a + b; });
+    CHECK(sum == (long)N * (N - 1));
+    list.reclaim();
+}
+
+/*************************************************************************
+ * Lookups through the shortcut index keep finding the keys that stay
+ * while the indexed nodes around them are removed and added back.
+ * **********************************************************************/
+void indexUnderChurn() {
+    const int N = 20000;
+    LazyList<int> list;
+    for (int i = 0; i < N; i++)
+        list.add(i);
+    list.enableIndex(32);
+
+    atomic<long> missing(0);
+    vector<thread> threads;
+    for (int t = 0; t < 2; t++) {
+        threads.emplace_back([&, t] {
+            for (int r = 0; r < 3; r++)
+                for (int i = t; i < N; i += 2) {
+                    if (i % 4 == 3)
+                        continue;
+                    list.remove(i);
+                    list.add(i);
+                }
+        });
+    }
+    threads.emplace_back([&] {
+        for (int r = 0; r < 3; r++)
+            for (int i = 3; i < N; i += 4)
+                if (!list.contains(i))
+                    missing++;
+    });
+    threads.emplace_back([&] {
+        for (int r = 0; r < 10; r++)
+            list.rebuildIndex();
+    });
+    for (auto &t : threads)
+        t.join();
+
+    CHECK(missing == 0);
+    CHECK(list.sizeExact() == N);
+    for (int i = 0; i < N; i++)
+        CHECK(list.contains(i));
+    list.reclaim();
+}
+
+/*************************************************************************
+ * tryAdd() and tryRemove() either give up with BUSY or take effect, so
+ * the successful calls account for the keys left.
+ * **********************************************************************/
+void tryOperations() {
+    LazyList<int> list;
+    atomic<long> net(0);
+    vector<thread> threads;
+    for (int t = 0; t < 4; t++) {
+        threads.emplace_back([&] {
+            for (int i = 0; i < 3000; i++) {
+                if (list.tryAdd(i % 50, 2) == TryResult::SUCCEEDED)
+                    net++;
+                if (list.tryRemove(i % 50, 2) == TryResult::SUCCEEDED)
+                    net--;
+            }
+        });
+    }
+    for (auto &t : threads)
+        t.join();
+
+    long present = 0;
+    for (int i = 0; i < 50; i++)
+        present += list.contains(i);
+    CHECK(net == present);
+    CHECK((long)list.sizeExact() == present);
+}
+
+/*************************************************************************
+ * Keys that are never removed keep passing the filter while it is
+ * rebuilt, resized and dropped under concurrent updates.
+ * **********************************************************************/
+void filterRebuilds() {
+    const int N = 4000;
+    LazyList<int> list;
+    for (int i = 0; i < N; i += 4)
+        list.add(i);
+    list.enableFilter(1 << 12);
+
+    atomic<bool> stop(false);
+    atomic<long> missing(0);
+    vector<thread> threads;
+    for (int t = 0; t < 2; t++) {
+        threads.emplace_back([&, t] {
+            unsigned random = t * 7919 + 1;
+            while (!stop) {
+                random = random * 1103515245 + 12345;
+                int key = (random >> 8) % N | 1;
+                if (random & 1)
+                    list.add(key);
+                else
+                    list.remove(key);
+            }
+        });
+    }
+    threads.emplace_back([&] {
+        while (!stop)
+            for (int i = 0; i < N; i += 4)
+                if (!list.contains(i))
+                    missing++;
+    });
+    for (int r = 0; r < 200; r++) {
+        list.enableFilter(r % 3 == 2 ? 0 : 64 + (r * 37) % 256);
+        this_thread::yield();
+    }
+    stop = true;
+    for (auto &t : threads)
+        t.join();
+
+    CHECK(missing == 0);
+    list.reclaim();
+}
+
+/*************************************************************************
+ * Splitting and concatenating while other threads update the list never
+ * loses a key, and concat() refuses overlapping ranges.
+ * **********************************************************************/
+void splitAndConcat() {
+    const int N = 4000;
+    LazyList<int> list, shard;
+    for (int i = 0; i < N; i++)
+        list.add(i);
+
+    atomic<bool> stop(false);
+    atomic<long> missing(0);
+    thread admin([&] {
+        for (int r = 0; r < 200; r++) {
+            CHECK(list.splitAt((r * 97) % N, shard));
+            CHECK(list.concat(shard));
+            if (r % 50 == 0)
+                list.compact();
+        }
+        stop = true;
+    });
+    thread updater([&] {
+        for (int i = 1; i < N && !stop; i += 2)
+            list.remove(i);
+        while (!stop)
+            for (int i = -1000; i < 0; i++) {
+                list.add(i);
+                list.remove(i);
+            }
+    });
+    thread reader([&] {
+        while (!stop)
+            for (int i = 0; i < N; i += 2)
+                if (!list.contains(i) && !shard.contains(i) && !list.contains(i) && !shard.contains(i))
+                    missing++;
+    });
+    admin.join();
+    updater.join();
+    reader.join();
+
+    for (int i = 1; i < N; i += 2)
+        list.remove(i);
+    list.reclaim();
+    shard.reclaim();
+    CHECK(missing == 0);
+    CHECK(shard.sizeExact() == 0);
+    CHECK(list.sizeExact() == N / 2 && list.size() == N / 2);
+
+    LazyList<int> overlapping;
+    overlapping.add(-5);
+    overlapping.add(N + 10);
+    CHECK(!list.concat(overlapping));
+}
+
+/*************************************************************************
+ * In deferred mode removed keys are gone at once and sweep() unlinks the
+ * nodes left behind.
+ * **********************************************************************/
+void deferredUnlink() {
+    LazyList<int> list;
+    list.setDeferredUnlink(true);
+    for (int i = 0; i < 1000; i++)
+        list.add(i);
+
+    vector<thread> threads;
+    for (int t = 0; t < 4; t++) {
+        threads.emplace_back([&, t] {
+            for (int i = t; i < 1000; i += 8)
+                list.remove(i);
+        });
+    }
+    threads.emplace_back([&] { list.sweep(); });
+    for (auto &t : threads)
+        t.join();
+
+    for (int i = 0; i < 1000; i++)
+        CHECK(list.contains(i) == (i % 8 >= 4));
+    list.sweep();
+    CHECK(list.sweep() == 0);
+    CHECK(list.sizeExact() == 500);
+    list.reclaim();
+}
+
+/*************************************************************************
+ * Every value of the key type can be stored, in the order given by the
+ * comparator, and keys that are not integers work alike.
+ * **********************************************************************/
+void comparatorKeys() {
+    LazyList<int, greater<int>> descending;
+    CHECK(descending.add(INT_MIN) && descending.add(INT_MAX) && descending.add(0));
+    CHECK(descending.contains(INT_MIN) && descending.contains(INT_MAX));
+    vector<int> order;
+    descending.parallelForEach(1, [&](int key) { order.push_back(key); });
+    CHECK((order == vector<int>{INT_MAX, 0, INT_MIN}));
+    CHECK(descending.remove(INT_MIN) && !descending.contains(INT_MIN));
+
+    LazyList<string> words;
+    for (string word : {"banana", "apple", "applesauce", "cherry", "apple"})
+        words.add(word);
+    CHECK(words.contains("applesauce") && !words.contains("apples"));
+    CHECK(words.remove("apple") && !words.contains("apple") && words.sizeExact() == 3);
+}
+
+int main() {
+    bulkConstruction();
+    clearDuringUpdates();
+    sizes();
+    walksDuringCompaction();
+    indexUnderChurn();
+    tryOperations();
+    filterRebuilds();
+    splitAndConcat();
+    deferredUnlink();
+    comparatorKeys();
+    return failures() != 0;
+}
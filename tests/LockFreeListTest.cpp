@@ -0,0 +1,263 @@
+#include <atomic>
+#include <climits>
+#include <functional>
+#include <iostream>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+#include "Check.hpp"
+#include "LockFreeList.hpp"
+
+/*************************************************************************
+ * Bulk construction keeps one node per key, and clear() and assign()
+ * leave only the new keys behind.
+ * **********************************************************************/
+void bulkConstruction() {
+    vector<int> keys;
+    for (int i = 1; i <= 1000; i++) {
+        keys.push_back(i);
+        keys.push_back(i);
+    }
+
+    LockFreeList<int> list(keys.begin(), keys.end());
+    CHECK(list.sizeExact() == 1000);
+    CHECK(list.contains(500) && !list.contains(1001));
+
+    list.clear();
+    CHECK(!list.contains(5) && list.sizeExact() == 0);
+
+    list.assign(keys.begin() + 200, keys.end());
+    CHECK(!list.contains(50) && list.contains(700) && list.sizeExact() == 900);
+    CHECK(list.add(2000) && list.remove(700) && !list.contains(700));
+    list.reclaim();
+}
+
+/*************************************************************************
+ * replace() moves a key in one step: it fails if the old key is missing
+ * or the new one is taken, and two keys renamed back and forth are always
+ * present exactly once.
+ * **********************************************************************/
+void replace() {
+    LockFreeList<int> list;
+    for (int i = 0; i < 100; i++)
+        list.add(i * 10);
+    CHECK(list.replace(10, 15) && !list.contains(10) && list.contains(15));
+    CHECK(!list.replace(10, 16));
+    CHECK(!list.replace(20, 30) && list.contains(20));
+
+    atomic<long> failed(0);
+    vector<thread> threads;
+    for (int t = 0; t < 4; t++) {
+        threads.emplace_back([&, t] {
+            int from = 100000 + t * 10, to = from + 5;
+            list.add(from);
+            for (int i = 0; i < 20000; i++) {
+                if (!list.replace(from, to))
+                    failed++;
+                swap(from, to);
+            }
+        });
+    }
+    threads.emplace_back([&] {
+        for (int i = 0; i < 20000; i++) {
+            list.add(7);
+            list.remove(7);
+        }
+    });
+    for (auto &t : threads)
+        t.join();
+
+    CHECK(failed == 0);
+    for (int t = 0; t < 4; t++)
+        CHECK(list.contains(100000 + t * 10) + list.contains(100005 + t * 10) == 1);
+
+    LockFreeList<int> contended;
+    contended.add(1);
+    threads.clear();
+    for (int t = 0; t < 4; t++) {
+        threads.emplace_back([&] {
+            for (int i = 0; i < 5000; i++) {
+                contended.replace(1, 2);
+                contended.replace(2, 1);
+            }
+        });
+    }
+    for (auto &t : threads)
+        t.join();
+    CHECK(contended.contains(1) + contended.contains(2) == 1);
+    CHECK(contended.sizeExact() == 1);
+    list.reclaim();
+    contended.reclaim();
+}
+
+/*************************************************************************
+ * Parallel walks, printList() and parallelReduce() show only the keys
+ * that are present, while replace() leaves descriptors behind.
+ * **********************************************************************/
+void walks() {
+    const int N = 20000;
+    vector<int> keys;
+    for (int i = 0; i < N; i++)
+        keys.push_back(2 * i);
+    LockFreeList<int> list(keys.begin(), keys.end());
+
+    atomic<bool> stop(false);
+    thread replacer([&] {
+        for (int r = 0; !stop; r++) {
+            int key = 2 * N + 2 * (r % 100);
+            list.add(key);
+            list.replace(key, key + 1);
+            list.remove(key + 1);
+        }
+    });
+    for (int r = 0; r < 50; r++) {
+        atomic<long> stable(0);
+        list.parallelForEach(4, [&](int key) {
+            if (key < 2 * N)
+                stable++;
+        });
+        CHECK(stable == N);
+    }
+    stop = true;
+    replacer.join();
+
+    LockFreeList<int> small;
+    for (int i = 0; i < 10; i++)
+        small.add(i);
+    small.replace(3, 30);
+    small.replace(5, 6);
+    small.remove(7);
+
+    stringstream out;
+    auto *old = cout.rdbuf(out.rdbuf());
+    small.printList();
+    cout.rdbuf(old);
+    CHECK(out.str() == "0 1 2 4 5 6 8 9 30 ");
+
+    long sum = small.parallelReduce(
+        2, 0L, [](long total, int key) { return total + key; }, [](long a, long b) { return a + b; });
+    CHECK(sum == 0 + 1 + 2 + 4 + 5 + 6 + 8 + 9 + 30);
+    list.reclaim();
+    small.reclaim();
+}
+
+/*************************************************************************
+ * Keys added and never removed are never reported absent while the
+ * filter is rebuilt over and over.
+ * **********************************************************************/
+void filterRebuilds() {
+    const long N = 1000;
+    LockFreeList<long> list;
+    atomic<bool> stop(false);
+    atomic<long> missing(0);
+    atomic<long> added[4];
+    for (auto &n : added)
+        n = 0;
+
+    thread rebuilder([&] {
+        for (int r = 0; !stop; r++)
+            list.enableFilter(1024 + (r % 7) * 512);
+    });
+    vector<thread> threads;
+    for (int t = 0; t < 4; t++) {
+        threads.emplace_back([&, t] {
+            for (long i = 1; i <= N; i++) {
+                list.add(i * 4 + t);
+                if (!list.contains(i * 4 + t))
+                    missing++;
+                added[t] = i;
+            }
+        });
+    }
+    thread reader([&] {
+        while (!stop)
+            for (int t = 0; t < 4; t++) {
+                long n = added[t];
+                for (long i = n; i > 0 && i > n - 50; i--)
+                    if (!list.contains(i * 4 + t))
+                        missing++;
+            }
+    });
+    for (auto &t : threads)
+        t.join();
+    stop = true;
+    rebuilder.join();
+    reader.join();
+
+    CHECK(missing == 0);
+    for (long key = 4; key < (N + 1) * 4; key++)
+        CHECK(list.contains(key));
+    list.reclaim();
+}
+
+/*************************************************************************
+ * popMin() and popMinRelaxed() hand out every key exactly once, also
+ * when the spread is wider than the list.
+ * **********************************************************************/
+void popMin() {
+    LockFreeList<int> list;
+    for (int r = 0; r < 200; r++) {
+        for (int i = 0; i < 3; i++)
+            list.add(i);
+        int key, popped = 0;
+        while (list.popMinRelaxed(key, 64))
+            popped++;
+        CHECK(popped == 3);
+        CHECK(!list.peekMin(key) && list.sizeExact() == 0);
+    }
+
+    const int N = 20000;
+    vector<int> keys;
+    for (int i = 0; i < N; i++)
+        keys.push_back(i);
+    list.assign(keys.begin(), keys.end());
+    vector<atomic<int>> seen(N);
+    vector<thread> threads;
+    for (int t = 0; t < 4; t++) {
+        threads.emplace_back([&, t] {
+            int key;
+            while (t % 2 ? list.popMinRelaxed(key, 16) : list.popMin(key))
+                seen[key]++;
+        });
+    }
+    for (auto &t : threads)
+        t.join();
+
+    long wrong = 0;
+    for (int i = 0; i < N; i++)
+        wrong += seen[i] != 1;
+    CHECK(wrong == 0);
+    list.reclaim();
+}
+
+/*************************************************************************
+ * Every value of the key type can be stored, in the order given by the
+ * comparator.
+ * **********************************************************************/
+void comparatorKeys() {
+    LockFreeList<int, greater<int>> descending;
+    CHECK(descending.add(INT_MIN) && descending.add(INT_MAX) && descending.add(0));
+    int key;
+    CHECK(descending.peekMin(key) && key == INT_MAX);
+    CHECK(descending.remove(INT_MIN) && !descending.contains(INT_MIN));
+
+    LockFreeList<string> words;
+    words.add("pear");
+    words.add("apple");
+    CHECK(words.replace("pear", "plum") && words.contains("plum") && !words.contains("pear"));
+}
+
+int main() {
+    bulkConstruction();
+    replace();
+    walks();
+    filterRebuilds();
+    popMin();
+    comparatorKeys();
+    return failures() != 0;
+}
@@ -0,0 +1,72 @@
+#include <atomic>
+#include <functional>
+#include <iostream>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+#include "Check.hpp"
+#include "LockFreePriorityQueue.hpp"
+
+/*************************************************************************
+ * An exact queue hands keys out in order and refuses duplicates.
+ * **********************************************************************/
+void order() {
+    LockFreePriorityQueue<int> queue;
+    for (int i = 10; i > 0; i--)
+        CHECK(queue.push(i));
+    CHECK(!queue.push(5));
+
+    int key;
+    CHECK(queue.peekMin(key) && key == 1);
+    for (int i = 1; i <= 10; i++)
+        CHECK(queue.popMin(key) && key == i);
+    CHECK(!queue.popMin(key) && !queue.peekMin(key) && queue.empty());
+
+    LockFreePriorityQueue<int, greater<int>> maxQueue;
+    maxQueue.push(3);
+    maxQueue.push(7);
+    CHECK(maxQueue.popMin(key) && key == 7);
+}
+
+/*************************************************************************
+ * Threads pushing and popping concurrently get every key exactly once,
+ * with an exact queue and with a relaxed one.
+ * **********************************************************************/
+void pushAndPop(size_t spread) {
+    const int THREADS = 4, N = 5000;
+    LockFreePriorityQueue<int> queue(spread);
+    vector<atomic<int>> seen(THREADS * N);
+    vector<thread> threads;
+    for (int t = 0; t < THREADS; t++) {
+        threads.emplace_back([&, t] {
+            for (int i = 0; i < N; i++) {
+                queue.push(t * N + i);
+                int key;
+                if (queue.popMin(key))
+                    seen[key]++;
+            }
+        });
+    }
+    for (auto &t : threads)
+        t.join();
+
+    int key;
+    while (queue.popMin(key))
+        seen[key]++;
+
+    long wrong = 0;
+    for (int i = 0; i < THREADS * N; i++)
+        wrong += seen[i] != 1;
+    CHECK(wrong == 0);
+    CHECK(queue.empty() && queue.size() == 0);
+}
+
+int main() {
+    order();
+    pushAndPop(1);
+    pushAndPop(16);
+    return failures() != 0;
+}
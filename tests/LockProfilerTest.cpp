@@ -0,0 +1,63 @@
+// Built with CONCURRENTLIST_PROFILE_LOCKS, see tests/CMakeLists.txt
+#include <iostream>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+#include "Check.hpp"
+#include "LazyList.hpp"
+#include "OptimisticList.hpp"
+
+/*************************************************************************
+ * Contended updates are attributed to their operation and to the keys
+ * they waited on, and sampled waits carry their key in the trace.
+ * **********************************************************************/
+template <class List>
+void contendedUpdates() {
+    LockProfiler::instance().reset();
+
+    List list;
+    vector<thread> threads;
+    for (int t = 0; t < 8; t++) {
+        threads.emplace_back([&] {
+            for (int r = 0; r < 20000; r++) {
+                list.add(r % 8);
+                list.remove(r % 8);
+            }
+        });
+    }
+    for (auto &t : threads)
+        t.join();
+
+    LockProfiler &profiler = LockProfiler::instance();
+    CHECK(profiler.waits(LockProfiler::ADD).count() > 0);
+    CHECK(profiler.holds(LockProfiler::REMOVE).count() > 0);
+
+    auto hot = profiler.hotKeys(5);
+    CHECK(!hot.empty() && hot.size() <= 5);
+    for (auto &entry : hot) {
+        int key = stoi(entry.first);
+        CHECK(key >= 0 && key < 8);
+    }
+
+    stringstream trace;
+    profiler.writeChromeTrace(trace);
+    CHECK(trace.str().find("\"key\":\"") != string::npos);
+
+    stringstream summary;
+    profiler.writeSummary(summary);
+    CHECK(summary.str().find("add,") != string::npos);
+
+    profiler.reset();
+    CHECK(profiler.hotKeys(5).empty() && profiler.waits(LockProfiler::ADD).count() == 0);
+}
+
+int main() {
+    contendedUpdates<LazyList<int>>();
+    contendedUpdates<OptimisticList<int>>();
+    return failures() != 0;
+}
@@ -0,0 +1,95 @@
+#include <atomic>
+#include <climits>
+#include <functional>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+#include "Check.hpp"
+#include "OptimisticList.hpp"
+
+/*************************************************************************
+ * Concurrent updates on disjoint keys leave exactly the keys expected,
+ * and both size counts agree with them.
+ * **********************************************************************/
+void updates() {
+    OptimisticList<int> list;
+    vector<thread> threads;
+    for (int t = 0; t < 4; t++) {
+        threads.emplace_back([&, t] {
+            for (int i = 0; i < 1000; i++) {
+                list.add(t + 4 * i);
+                if (i % 2)
+                    list.remove(t + 4 * i);
+            }
+        });
+    }
+    for (auto &t : threads)
+        t.join();
+
+    for (int i = 0; i < 4000; i++)
+        CHECK(list.contains(i) == (i / 4 % 2 == 0));
+    CHECK(list.sizeExact() == 2000 && list.size() == 2000);
+    CHECK(!list.add(0) && list.remove(0) && !list.remove(0));
+}
+
+/*************************************************************************
+ * tryAdd() and tryRemove() either give up with BUSY or take effect, so
+ * the successful calls account for the keys left.
+ * **********************************************************************/
+void tryOperations() {
+    OptimisticList<int> list;
+    CHECK(list.tryAdd(1) == TryResult::SUCCEEDED);
+    CHECK(list.tryAdd(1) == TryResult::FAILED);
+    CHECK(list.tryRemove(2) == TryResult::FAILED);
+    CHECK(list.tryRemove(1) == TryResult::SUCCEEDED);
+
+    atomic<long> net(0);
+    vector<thread> threads;
+    for (int t = 0; t < 4; t++) {
+        threads.emplace_back([&] {
+            for (int i = 0; i < 3000; i++) {
+                if (list.tryAdd(i % 50, 2) == TryResult::SUCCEEDED)
+                    net++;
+                if (list.tryRemove(i % 50, 2) == TryResult::SUCCEEDED)
+                    net--;
+            }
+        });
+    }
+    for (auto &t : threads)
+        t.join();
+
+    long present = 0;
+    for (int i = 0; i < 50; i++)
+        present += list.contains(i);
+    CHECK(net == present);
+    CHECK((long)list.sizeExact() == present);
+}
+
+/*************************************************************************
+ * Every value of the key type can be stored, in the order given by the
+ * comparator, and keys that are not integers work alike.
+ * **********************************************************************/
+void comparatorKeys() {
+    OptimisticList<int, greater<int>> descending;
+    CHECK(descending.add(INT_MIN) && descending.add(INT_MAX) && descending.add(0));
+    CHECK(descending.contains(INT_MIN) && descending.contains(INT_MAX));
+    CHECK(descending.remove(INT_MAX) && !descending.contains(INT_MAX));
+    CHECK(descending.sizeExact() == 2);
+
+    OptimisticList<string> words;
+    words.add("cherry");
+    words.add("apple");
+    CHECK(words.contains("apple") && !words.contains("apples"));
+}
+
+int main() {
+    updates();
+    tryOperations();
+    comparatorKeys();
+    return failures() != 0;
+}
@@ -0,0 +1,253 @@
+#include <atomic>
+#include <cerrno>
+#include <iostream>
+#include <new>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+using namespace std;
+
+#include "Check.hpp"
+#include "SharedLockFreeList.hpp"
+
+// Segment names are per process so concurrent test runs do not share sets
+string segment(const string &suffix) {
+    return "/SharedLockFreeListTest-" + to_string(getpid()) + "-" + suffix;
+}
+
+/*************************************************************************
+ * Updates made by several processes are all visible to the next process
+ * to attach.
+ * **********************************************************************/
+void processes() {
+    const string name = segment("processes");
+    SharedLockFreeList<long>::unlink(name);
+
+    const int P = 4, N = 2000;
+    for (int p = 0; p < P; p++) {
+        if (fork() == 0) {
+            SharedLockFreeList<long> set(name, 100000);
+            for (int i = 0; i < N; i++) {
+                set.add(p * N + i);
+                if (i % 2)
+                    set.remove(p * N + i - 1);
+            }
+            _exit(0);
+        }
+    }
+    for (int p = 0; p < P; p++) {
+        int status;
+        wait(&status);
+        CHECK(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+    }
+
+    SharedLockFreeList<long> set(name, 1);
+    size_t present = 0;
+    for (long key = 0; key < P * N; key++) {
+        bool in = set.contains(key);
+        CHECK(in == (key % 2 == 1));
+        present += in;
+    }
+    CHECK(present == P * N / 2 && set.size() == present);
+    SharedLockFreeList<long>::unlink(name);
+}
+
+/*************************************************************************
+ * Adds that lose the race for a key hand their node back, so duplicate
+ * adds on a small segment never exhaust it.
+ * **********************************************************************/
+void duplicateAdds() {
+    const string name = segment("duplicates");
+    SharedLockFreeList<long>::unlink(name);
+    {
+        SharedLockFreeList<long> set(name, 200);
+        for (long i = 0; i < 100; i++)
+            set.add(i);
+
+        atomic<long> wrong(0);
+        vector<thread> threads;
+        for (int t = 0; t < 4; t++) {
+            threads.emplace_back([&] {
+                try {
+                    for (int r = 0; r < 2000; r++)
+                        for (long i = 0; i < 100; i++)
+                            if (set.add(i))
+                                wrong++;
+                } catch (bad_alloc &) {
+                    wrong += 1000000;
+                }
+            });
+        }
+        for (int t = 0; t < 4; t++) {
+            threads.emplace_back([&] {
+                try {
+                    for (long i = 100; i < 190; i++)
+                        set.add(i);
+                } catch (bad_alloc &) {
+                    wrong += 1000000;
+                }
+            });
+        }
+        for (auto &t : threads)
+            t.join();
+
+        CHECK(wrong == 0);
+        CHECK(set.size() == 190);
+        for (long i = 0; i < 190; i++)
+            CHECK(set.contains(i));
+    }
+    SharedLockFreeList<long>::unlink(name);
+}
+
+/*************************************************************************
+ * Threads and processes churn through many more nodes than the segment
+ * holds, one process is killed midway, and reclamation carries on.
+ * **********************************************************************/
+void churn() {
+    const string name = segment("churn");
+    SharedLockFreeList<long>::unlink(name);
+    {
+        SharedLockFreeList<long> set(name, 300);
+        for (long i = 0; i < 50; i++)
+            set.add(-1 - i);
+
+        vector<pid_t> children;
+        for (int p = 0; p < 3; p++) {
+            pid_t pid = fork();
+            if (pid == 0) {
+                SharedLockFreeList<long> child(name, 300);
+                long missing = 0;
+                try {
+                    // The last child runs until it is killed
+                    for (long r = 0; p == 2 || r < 20000; r++) {
+                        long key = p * 100 + r % 40;
+                        child.add(key);
+                        child.remove(key);
+                        for (long i = 0; i < 50; i += 7)
+                            missing += !child.contains(-1 - i);
+                    }
+                } catch (bad_alloc &) {
+                    _exit(3);
+                }
+                _exit(missing ? 2 : 0);
+            }
+            children.push_back(pid);
+        }
+
+        atomic<long> wrong(0);
+        vector<thread> threads;
+        for (int t = 0; t < 4; t++) {
+            threads.emplace_back([&, t] {
+                try {
+                    for (int r = 0; r < 50000; r++) {
+                        long key = 1000 + t * 100 + r % 30;
+                        if (!set.add(key) || !set.remove(key))
+                            wrong++;
+                    }
+                } catch (bad_alloc &) {
+                    wrong += 1000000;
+                }
+            });
+        }
+
+        // Reap the killed child at once, a zombie still counts as alive
+        usleep(200000);
+        kill(children[2], SIGKILL);
+        waitpid(children[2], NULL, 0);
+        for (auto &t : threads)
+            t.join();
+        for (int p = 0; p < 2; p++) {
+            int status;
+            waitpid(children[p], &status, 0);
+            CHECK(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+        }
+        CHECK(wrong == 0);
+
+        bool stalled = false;
+        try {
+            for (int r = 0; r < 20000; r++) {
+                set.add(5000 + r % 10);
+                set.remove(5000 + r % 10);
+            }
+        } catch (bad_alloc &) {
+            stalled = true;
+        }
+        CHECK(!stalled);
+
+        // The killed child may have left its key behind or size() off by one
+        for (long key = 200; key < 240; key++)
+            set.remove(key);
+        CHECK(set.size() >= 49 && set.size() <= 51);
+        for (long i = 0; i < 50; i++)
+            CHECK(set.contains(-1 - i));
+    }
+    SharedLockFreeList<long>::unlink(name);
+}
+
+/*************************************************************************
+ * A full segment throws bad_alloc, a segment of another key type is
+ * refused, and a segment whose creator never finished times out.
+ * **********************************************************************/
+void attachErrors() {
+    const string tinyName = segment("tiny");
+    SharedLockFreeList<long>::unlink(tinyName);
+    {
+        SharedLockFreeList<long> tiny(tinyName, 2);
+        tiny.add(1);
+        tiny.add(2);
+        bool threw = false;
+        try {
+            tiny.add(3);
+        } catch (bad_alloc &) {
+            threw = true;
+        }
+        CHECK(threw);
+
+        struct Wide {
+            long a, b, c;
+            bool operator<(const Wide &) const {
+                return false;
+            }
+            bool operator==(const Wide &) const {
+                return true;
+            }
+        };
+        threw = false;
+        try {
+            SharedLockFreeList<Wide> wide(tinyName, 2);
+        } catch (system_error &) {
+            threw = true;
+        }
+        CHECK(threw);
+    }
+    SharedLockFreeList<long>::unlink(tinyName);
+
+    const string deadName = segment("dead");
+    int fd = shm_open(deadName.c_str(), O_CREAT | O_RDWR, 0600);
+    CHECK(fd != -1 && ftruncate(fd, 1 << 16) == 0);
+    close(fd);
+    int error = 0;
+    try {
+        SharedLockFreeList<long> dead(deadName, 10);
+    } catch (system_error &e) {
+        error = e.code().value();
+    }
+    CHECK(error == ETIMEDOUT);
+    shm_unlink(deadName.c_str());
+}
+
+int main() {
+    processes();
+    duplicateAdds();
+    churn();
+    attachErrors();
+    return failures() != 0;
+}